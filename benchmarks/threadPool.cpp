@@ -0,0 +1,118 @@
+#include <jThread/jThread.h>
+
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+/*
+
+    Throughput of tiny jobs through jThread::ThreadPool, for the shared
+    queue and work stealing schedules.
+
+        external - every job queued from the main thread
+        spawned  - one root job per thread, each queueing its share of the
+                   jobs from inside the pool
+
+    threadPoolBenchmark [-maxJobs N] [-maxThreads N]
+
+*/
+
+std::atomic<uint64_t> sink(0);
+
+void tiny(uint64_t i)
+{
+    sink.fetch_add(i, std::memory_order_relaxed);
+}
+
+double external(jThread::ThreadPool & pool, uint64_t jobs)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < jobs; i++)
+    {
+        pool.queueJob([i]() { tiny(i); });
+    }
+    pool.wait();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+double spawned(jThread::ThreadPool & pool, uint64_t jobs)
+{
+    const uint64_t roots = pool.size();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t r = 0; r < roots; r++)
+    {
+        pool.queueJob
+        (
+            [&pool, r, roots, jobs]()
+            {
+                for (uint64_t i = (r*jobs)/roots; i < ((r+1)*jobs)/roots; i++)
+                {
+                    pool.queueJob([i]() { tiny(i); });
+                }
+            }
+        );
+    }
+    pool.wait();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+int main(int argv, char ** argc)
+{
+
+    uint64_t maxJobs = 10000000;
+    unsigned maxThreads = 64;
+
+    if (argv >= 3)
+    {
+        std::map<std::string, std::string> args;
+        std::vector<std::string> inputs;
+        for (int i = 1; i < argv; i++)
+        {
+            inputs.push_back(argc[i]);
+        }
+        std::reverse(inputs.begin(), inputs.end());
+        while (inputs.size() >= 2)
+        {
+            std::string arg = inputs.back();
+            inputs.pop_back();
+            args[arg] = inputs.back();
+            inputs.pop_back();
+        }
+
+        if (args.find("-maxJobs") != args.end())
+        {
+            maxJobs = std::stoull(args["-maxJobs"]);
+        }
+        if (args.find("-maxThreads") != args.end())
+        {
+            maxThreads = std::stoi(args["-maxThreads"]);
+        }
+    }
+
+    std::cout << "schedule, threads, jobs, external jobs/s, spawned jobs/s\n";
+
+    for (jThread::Schedule schedule : {jThread::Schedule::SHARED_QUEUE, jThread::Schedule::WORK_STEALING})
+    {
+        for (unsigned threads : {1, 4, 16, 64})
+        {
+            if (threads > maxThreads) { continue; }
+            jThread::ThreadPool pool(threads, schedule);
+            for (uint64_t jobs = 10000; jobs <= maxJobs; jobs *= 10)
+            {
+                const double e = external(pool, jobs);
+                const double s = spawned(pool, jobs);
+                std::cout << (schedule == jThread::Schedule::SHARED_QUEUE ? "shared" : "stealing") << ", "
+                          << threads << ", "
+                          << jobs << ", "
+                          << std::setprecision(4) << jobs/e << ", "
+                          << jobs/s << "\n";
+            }
+        }
+    }
+
+    return 0;
+}
@@ -12,6 +12,7 @@ EXAMPLES=0
 CLEAN=1
 NO_WARN=0
 SANITISE=0
+HEADLESS=0
 
 while [[ $# -gt 0 ]]; do
   case $1 in
@@ -57,6 +58,10 @@ while [[ $# -gt 0 ]]; do
       SANITISE=1
       shift
       ;;
+    --headless)
+      HEADLESS=1
+      shift
+      ;;
     -d|--development)
       NO_WARN=1
       shift
@@ -146,7 +151,7 @@ then
   cd ..
 else
   cd build
-  cmake -D BENCHMARK=$BENCHMARK -D SANITISE=$SANITISE -D VERBOSE=$VERBOSE -D VALIDATION=$VALIDATION -D RELEASE=$RELEASE -D TEST_SUITE=$TEST -D NO_WARN=$NO_WARN -D EXAMPLES=$EXAMPLES ..
+  cmake -D BENCHMARK=$BENCHMARK -D HEADLESS=$HEADLESS -D SANITISE=$SANITISE -D VERBOSE=$VERBOSE -D VALIDATION=$VALIDATION -D RELEASE=$RELEASE -D TEST_SUITE=$TEST -D NO_WARN=$NO_WARN -D EXAMPLES=$EXAMPLES ..
   make -j 4
   export STATUS=$?
   cd ..
@@ -0,0 +1,76 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/*
+
+    Summary of a benchmark run, printed as one JSON object or a CSV header
+    and row so runs across builds and grid sizes can be collected.
+
+        steps/s            steps over the whole run's wall time
+        cell updates/s     steps/s times cells per step
+        p50, p95, p99      GPU step times in milliseconds, nearest rank
+
+*/
+
+struct BenchmarkResult
+{
+    std::string name;
+    uint64_t cells;
+    uint64_t steps;
+    double seconds;
+    // seconds per step, in any order
+    std::vector<double> stepSeconds;
+
+    double percentile(double p) const
+    {
+        if (stepSeconds.empty()) { return 0.0; }
+        std::vector<double> sorted = stepSeconds;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = size_t(std::ceil(p/100.0*sorted.size()));
+        rank = std::min(std::max(rank, size_t(1)), sorted.size());
+        return sorted[rank-1];
+    }
+
+    double stepsPerSecond() const { return seconds > 0.0 ? steps/seconds : 0.0; }
+
+    std::string json() const
+    {
+        std::stringstream s;
+        s << "{\"name\": \"" << name << "\""
+          << ", \"cells\": " << cells
+          << ", \"steps\": " << steps
+          << ", \"seconds\": " << seconds
+          << ", \"stepsPerSecond\": " << stepsPerSecond()
+          << ", \"cellUpdatesPerSecond\": " << stepsPerSecond()*cells
+          << ", \"p50ms\": " << percentile(50.0)*1e3
+          << ", \"p95ms\": " << percentile(95.0)*1e3
+          << ", \"p99ms\": " << percentile(99.0)*1e3
+          << "}";
+        return s.str();
+    }
+
+    std::string csv() const
+    {
+        std::stringstream s;
+        s << "name, cells, steps, seconds, steps/s, cell updates/s, p50 ms, p95 ms, p99 ms\n"
+          << name << ", "
+          << cells << ", "
+          << steps << ", "
+          << seconds << ", "
+          << stepsPerSecond() << ", "
+          << stepsPerSecond()*cells << ", "
+          << percentile(50.0)*1e3 << ", "
+          << percentile(95.0)*1e3 << ", "
+          << percentile(99.0)*1e3;
+        return s.str();
+    }
+};
+
+#endif /* BENCHMARK_H */
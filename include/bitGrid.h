@@ -0,0 +1,75 @@
+#ifndef BITGRID_H
+#define BITGRID_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+
+    One bit per cell bitboard. Each row is width/64 uint64_t words, bit
+    x%64 of word x/64 holding cell x, so the two rows of a Margolus block
+    row are a pair of word arrays and a 2x2 block is two adjacent bits in
+    each (even bits the left column, odd bits the right column).
+
+*/
+
+class BitGrid
+{
+
+public:
+
+    BitGrid() = default;
+
+    BitGrid(uint64_t width, uint64_t height)
+    : width(width), height(height), wordsPerRow(width/64),
+      words(wordsPerRow*height, 0)
+    {
+        if (width == 0 || width % 64 != 0)
+        {
+            throw std::runtime_error("BitGrid width must be a multiple of 64");
+        }
+    }
+
+    bool get(uint64_t i, uint64_t j) const
+    {
+        return (words[j*wordsPerRow+i/64] >> (i%64)) & 1;
+    }
+
+    void set(uint64_t i, uint64_t j, bool value)
+    {
+        uint64_t & w = words[j*wordsPerRow+i/64];
+        const uint64_t bit = uint64_t(1) << (i%64);
+        w = value ? (w | bit) : (w & ~bit);
+    }
+
+    uint64_t * row(uint64_t j) { return &words[j*wordsPerRow]; }
+    const uint64_t * row(uint64_t j) const { return &words[j*wordsPerRow]; }
+
+    void clear() { std::fill(words.begin(), words.end(), 0); }
+
+    uint64_t count() const
+    {
+        uint64_t c = 0;
+        for (uint64_t w : words) { c += __builtin_popcountll(w); }
+        return c;
+    }
+
+    uint64_t getWidth() const { return width; }
+    uint64_t getHeight() const { return height; }
+    uint64_t getWordsPerRow() const { return wordsPerRow; }
+    uint64_t bytes() const { return words.size()*sizeof(uint64_t); }
+
+    const std::vector<uint64_t> & data() const { return words; }
+
+private:
+
+    uint64_t width = 0;
+    uint64_t height = 0;
+    uint64_t wordsPerRow = 0;
+
+    std::vector<uint64_t> words;
+};
+
+#endif /* BITGRID_H */
@@ -0,0 +1,120 @@
+#ifndef BLOCKKERNEL_H
+#define BLOCKKERNEL_H
+
+#include <cstdint>
+#include <string>
+
+/*
+
+    Kernels applying the Margolus block rule to a row of blocks held as a
+    pair of BitGrid row words, block b of word k being bits 2b and 2b+1 of
+    top[k] and bottom[k] (already shifted for the odd phase).
+
+    The rule is given as 16 entry tables indexed by the 4 bit block hash,
+    so the SIMD kernels can look it up with a byte shuffle. For a block
+    with hash h and random byte d the outcome is
+
+        d < first[h] ? a[h] : (d < second[h] ? b[h] : c[h])
+
+    random holds 32 bytes per word, byte b for block b. Every kernel
+    produces identical results for the same input.
+
+*/
+
+struct BlockTables
+{
+    uint8_t first[16];
+    uint8_t second[16];
+    uint8_t a[16];
+    uint8_t b[16];
+    uint8_t c[16];
+
+    uint8_t apply(uint8_t hash, uint8_t d) const
+    {
+        return d < first[hash] ? a[hash] : (d < second[hash] ? b[hash] : c[hash]);
+    }
+
+    // set of hashes (bit h for hash h) that may change under the rule
+    uint16_t mobile() const
+    {
+        uint16_t m = 0;
+        for (uint8_t h = 0; h < 16; h++)
+        {
+            if (a[h] != h || b[h] != h || c[h] != h) { m |= 1 << h; }
+        }
+        return m;
+    }
+};
+
+typedef void (*BlockKernel)
+(
+    uint64_t * top,
+    uint64_t * bottom,
+    uint64_t words,
+    const uint8_t * random,
+    const BlockTables & tables
+);
+
+enum class KernelType { SCALAR, SSE42, AVX2, AVX512 };
+
+void blockKernelScalar(uint64_t * top, uint64_t * bottom, uint64_t words, const uint8_t * random, const BlockTables & tables);
+
+#ifdef X86_KERNELS
+void blockKernelSSE42(uint64_t * top, uint64_t * bottom, uint64_t words, const uint8_t * random, const BlockTables & tables);
+void blockKernelAVX2(uint64_t * top, uint64_t * bottom, uint64_t words, const uint8_t * random, const BlockTables & tables);
+void blockKernelAVX512(uint64_t * top, uint64_t * bottom, uint64_t words, const uint8_t * random, const BlockTables & tables);
+#endif
+
+// whether this binary and cpu can run the kernel
+bool kernelSupported(KernelType type);
+
+// fastest supported kernel, detected once via cpuid
+KernelType bestKernel();
+
+BlockKernel getKernel(KernelType type);
+
+std::string to_string(KernelType type);
+
+// blocks of a word pair whose hash is in the set hashes, bit 2b for block b
+inline uint64_t blocksIn(uint64_t top, uint64_t bottom, uint16_t hashes)
+{
+    const uint64_t even = 0x5555555555555555ull;
+    const uint64_t tl = top & even;
+    const uint64_t tr = (top >> 1) & even;
+    const uint64_t bl = bottom & even;
+    const uint64_t br = (bottom >> 1) & even;
+    uint64_t m = 0;
+    for (uint8_t h = 0; h < 16; h++)
+    {
+        if (!((hashes >> h) & 1)) { continue; }
+        m |= (h & 1 ? tl : ~tl) & (h & 2 ? tr : ~tr)
+           & (h & 4 ? bl : ~bl) & (h & 8 ? br : ~br);
+    }
+    return m & even;
+}
+
+// gather the even bits of x into the low 32 bits
+inline uint32_t compressEvenBits(uint64_t x)
+{
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return uint32_t(x);
+}
+
+// inverse of compressEvenBits, bit i to bit 2i
+inline uint64_t spreadEvenBits(uint32_t v)
+{
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+#endif /* BLOCKKERNEL_H */
@@ -0,0 +1,160 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include <bitGrid.h>
+#include <margolusEngine.h>
+#include <snapshot.h>
+
+/*
+
+    Binary checkpoints of a Margolus world: the cells, and optionally the
+    obstacles, as 1 bit planes, with what is needed to carry on stepping
+    exactly where the run left off.
+
+        "SNOWCKPT"          magic
+        uint32              version
+        uint32              planes, cells first then obstacles
+        uint64              width, height
+        uint32              phase type
+        uint64              seed, steps
+        float               p1 p2 p31 p32 p6 p7 p9 p11 spawnProb
+        uint32              tile size (MargolusEngine::TILE)
+
+    then every tile, row by row of tiles and plane by plane within a tile
+    row, as
+
+        uint32              run length bytes
+        uint32              zlib bytes, 0 if the runs are stored as is,
+                            RAW_TILE if the words are
+        bytes
+
+    All little endian. A tile's bits, row major, are coded as the lengths
+    of alternating runs of 0s and 1s, starting with 0s, as LEB128
+    varints. The last run is implied, so an empty tile is 8 bytes and a
+    full one 9. Runs are then deflated when that makes them smaller. A
+    tile too busy for runs to pay, with as many changes of bit as it has
+    bytes, is stored as its words with RAW_TILE for the zlib bytes.
+
+    Tiles are coded in parallel a batch of tile rows at a time and
+    streamed through a bounded buffer, so memory stays small for any
+    world size.
+
+*/
+
+struct Checkpoint
+{
+    uint64_t width = 0;
+    uint64_t height = 0;
+    int type = 0;
+    uint64_t seed = 0;
+    uint64_t steps = 0;
+    MargolusEngine::Parameters parameters;
+    // cells, then obstacles if present
+    std::vector<BitGrid> planes;
+};
+
+// copies TILE words of tile (tx, ty) of a plane into words, one per row
+// (rows past the grid's height are ignored)
+typedef std::function<void(unsigned plane, uint64_t tx, uint64_t ty, uint64_t * words)> TileSource;
+
+// zlib bytes of a tile stored as its words, rleBytes of them
+const uint32_t RAW_TILE = 0xffffffff;
+
+// bytes of a coded tile's data following its two sizes
+inline uint32_t codedTileBytes(uint32_t rleBytes, uint32_t zBytes)
+{
+    return zBytes > 0 && zBytes != RAW_TILE ? zBytes : rleBytes;
+}
+
+// run length code one tile of rows words, appended to out, then
+// deflate the runs if zlib and that makes them smaller
+void encodeTile(const uint64_t * words, uint64_t rows, std::vector<uint8_t> & out, bool zlib = true);
+
+// inverse of encodeTile, filling rows words; throws on corrupt data
+void decodeTile(const uint8_t * data, uint32_t rleBytes, uint32_t zBytes, uint64_t * words, uint64_t rows);
+
+// the planes of header are ignored, tiles come from source
+void saveCheckpoint
+(
+    std::string path,
+    const Checkpoint & header,
+    unsigned planes,
+    TileSource source,
+    unsigned threads = 1
+);
+
+void saveCheckpoint(std::string path, const Checkpoint & checkpoint, unsigned threads = 1);
+
+// header and planes of the engine's current state
+Checkpoint checkpoint(const MargolusEngine & engine);
+
+// the cells of a snapshot, while its engine carries on stepping
+void saveCheckpoint(std::string path, Snapshot & snapshot, unsigned threads = 1);
+
+Checkpoint loadCheckpoint(std::string path, unsigned threads = 1);
+
+/*
+
+    Saves snapshots on a background thread, one at a time, so a running
+    engine can autosave without pausing:
+
+        CheckpointWriter writer;
+        ...
+        if (autosaveDue && writer.idle())
+        {
+            writer.save("world.ckpt", engine.takeSnapshot());
+        }
+
+    Each checkpoint is written beside path and renamed over it once
+    complete, so an interrupted save never leaves a broken file. An
+    exception thrown while saving is rethrown by the next save() or wait().
+
+*/
+
+class CheckpointWriter
+{
+
+public:
+
+    CheckpointWriter();
+
+    ~CheckpointWriter();
+
+    // whether no save is in progress
+    bool idle();
+
+    // false, saving nothing, if busy with the previous snapshot
+    bool save(std::string path, std::shared_ptr<Snapshot> snapshot);
+
+    // until the save in progress is done
+    void wait();
+
+    // checkpoints written so far
+    uint64_t getSaved();
+
+private:
+
+    std::mutex lock;
+    std::condition_variable condition;
+    bool terminate;
+    std::string path;
+    std::shared_ptr<Snapshot> pending;
+    std::exception_ptr error;
+    uint64_t saved;
+
+    std::thread thread;
+
+    void main();
+};
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,105 @@
+#ifndef FRAMERECORDER_H
+#define FRAMERECORDER_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include <jThread/jThread.h>
+#include <bitGrid.h>
+
+/*
+
+    Writes frames as a numbered PNG sequence, prefix000000123.png for the
+    frame of step 123, without ever making the caller wait.
+
+        push        copies the frame's cells, the only work done by the
+                    calling thread, and queues it
+        workers     a jThread pool colour maps and deflates frames in
+                    parallel into in-memory PNGs
+        writer      one thread writes finished PNGs to disk in turn
+
+    At most capacity frames are held anywhere in the pipeline. A frame
+    pushed while it is full is not taken: under DROP it is simply lost,
+    under DECIMATE only every 2nd, then 4th, ... frame is taken from then
+    on, relaxing back as the pipeline drains, so a long run keeps an even
+    spread of frames instead of bursts.
+
+*/
+
+class FrameRecorder
+{
+
+public:
+
+    enum class Policy { DROP, DECIMATE };
+
+    struct Palette
+    {
+        uint8_t empty[3];
+        uint8_t particle[3];
+    };
+
+    FrameRecorder
+    (
+        std::string prefix,
+        unsigned workers = 1,
+        size_t capacity = 8,
+        Policy policy = Policy::DECIMATE,
+        Palette palette = {{0, 0, 0}, {255, 255, 255}}
+    );
+
+    // finishes every frame taken
+    ~FrameRecorder();
+
+    // whether the frame was taken
+    bool push(uint64_t step, const BitGrid & cells);
+    bool push(uint64_t step, BitGrid && cells);
+
+    // until every frame taken is on disk
+    void finish();
+
+    uint64_t getTaken();
+    uint64_t getSkipped();
+    uint64_t getWritten();
+
+    // a frame as a 1 bit paletted PNG, empty and particle the palette, y = 0 the top row
+    static std::vector<uint8_t> encode(const BitGrid & cells, const Palette & palette);
+
+private:
+
+    struct Encoded
+    {
+        uint64_t step;
+        std::vector<uint8_t> png;
+    };
+
+    std::string prefix;
+    size_t capacity;
+    Policy policy;
+    Palette palette;
+
+    std::mutex lock;
+    std::condition_variable condition;
+    // frames taken and not yet written
+    size_t inFlight;
+    uint64_t offered, decimation;
+    uint64_t taken, skipped, written;
+    bool terminate;
+    std::deque<Encoded> encoded;
+
+    std::unique_ptr<jThread::ThreadPool> pool;
+    std::thread writer;
+
+    // reserves room for a frame under the policy
+    bool admit();
+    void encodeJob(uint64_t step, std::shared_ptr<BitGrid> cells);
+    void writeLoop();
+};
+
+#endif /* FRAMERECORDER_H */
@@ -4,7 +4,15 @@
 #include <jGL/OpenGL/gl.h>
 #include <jGL/OpenGL/Shader/glShader.h>
 
+#include <passTimer.h>
+#include <trace.h>
+
+#include <gsl/span>
+
 #include <vector>
+#include <deque>
+#include <functional>
+#include <cstring>
 #include <map>
 #include <string>
 #include <algorithm>
@@ -47,17 +55,18 @@ void initTexture2DRGBA32F(GLuint id, uint64_t n, uint64_t m)
     );
 }
 
-void transferToTexture2DRGBA32F(GLuint id, std::vector<float> data, uint64_t n, uint64_t m)
+void transferToTexture2DRGBA32F(GLuint id, const std::vector<float> & data, uint64_t n, uint64_t m)
 {
     glBindTexture(GL_TEXTURE_2D,id);
 
-    glTexImage2D(
+    // the texture is already allocated, so only its texels are replaced
+    glTexSubImage2D(
         GL_TEXTURE_2D,
         0,
-        GL_RGBA32F,
+        0,
+        0,
         n,
         m,
-        0,
         GL_RGBA,
         GL_FLOAT,
         data.data()
@@ -100,17 +109,18 @@ void initTexture2DR32F(GLuint id, uint64_t n, uint64_t m)
     );
 }
 
-void transferToTexture2DR32F(GLuint id, std::vector<float> data, uint64_t n, uint64_t m)
+void transferToTexture2DR32F(GLuint id, const std::vector<float> & data, uint64_t n, uint64_t m)
 {
     glBindTexture(GL_TEXTURE_2D,id);
 
-    glTexImage2D(
+    // the texture is already allocated, so only its texels are replaced
+    glTexSubImage2D(
         GL_TEXTURE_2D,
         0,
-        GL_R32F,
+        0,
+        0,
         n,
         m,
-        0,
         GL_RED,
         GL_FLOAT,
         data.data()
@@ -133,7 +143,7 @@ void initTexture2D(GLuint id, uint64_t n, uint64_t m, uint64_t channels)
     throw std::runtime_error("Unsupported channels: "+channels);
 }
 
-void transferToTexture2D(GLuint id, std::vector<float> data, uint64_t n, uint64_t m, uint64_t channels)
+void transferToTexture2D(GLuint id, const std::vector<float> & data, uint64_t n, uint64_t m, uint64_t channels)
 {
     switch (channels)
     {
@@ -149,6 +159,333 @@ void transferToTexture2D(GLuint id, std::vector<float> data, uint64_t n, uint64_
     throw std::runtime_error("Unsupported channels: "+channels);
 }
 
+/*
+    Texel formats for attributes and outputs. FLOAT is GL_R32F or
+    GL_RGBA32F by channel count and is read as a sampler2D. R8UI, R16UI,
+    R32UI and PACKED_R32UI are read as a usampler2D and written as a
+    uvec4 output. RG8 is normalised, so it is read as a sampler2D.
+    PACKED_R32UI holds 32 cells per texel along x, bit i of texel tx
+    being cell 32*tx+i, so its texture is w/32 texels wide.
+
+    Host shadows are std::vector<float> for FLOAT, uint8_t for R8UI and
+    RG8, uint16_t for R16UI and uint32_t for R32UI and PACKED_R32UI.
+*/
+enum class TextureFormat {FLOAT, R8UI, R16UI, R32UI, RG8, PACKED_R32UI};
+
+struct TexelFormat
+{
+    GLint internalFormat;
+    GLenum format;
+    GLenum type;
+};
+
+TexelFormat texelFormat(TextureFormat format, uint64_t channels)
+{
+    switch (format)
+    {
+        case TextureFormat::FLOAT:
+            if (channels == 4) { return {GL_RGBA32F, GL_RGBA, GL_FLOAT}; }
+            return {GL_R32F, GL_RED, GL_FLOAT};
+        case TextureFormat::R8UI:
+            return {GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE};
+        case TextureFormat::R16UI:
+            return {GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT};
+        case TextureFormat::RG8:
+            return {GL_RG8, GL_RG, GL_UNSIGNED_BYTE};
+        default:
+            return {GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT};
+    }
+}
+
+bool isInteger(TextureFormat format)
+{
+    return format != TextureFormat::FLOAT && format != TextureFormat::RG8;
+}
+
+// texels along x for w cells
+uint64_t textureWidth(TextureFormat format, uint64_t w)
+{
+    if (format == TextureFormat::PACKED_R32UI)
+    {
+        if (w % 32 != 0) { throw std::runtime_error("Packed attribute width must be a multiple of 32"); }
+        return w/32;
+    }
+    return w;
+}
+
+// host values (floats, bytes, shorts or words) for a w x h attribute
+uint64_t hostValues(TextureFormat format, uint64_t w, uint64_t h, uint64_t channels)
+{
+    switch (format)
+    {
+        case TextureFormat::FLOAT:
+            return w*h*channels;
+        case TextureFormat::RG8:
+            return w*h*2;
+        default:
+            return textureWidth(format, w)*h;
+    }
+}
+
+void initTexture2D(GLuint id, uint64_t n, uint64_t m, uint64_t channels, TextureFormat format)
+{
+    if (format == TextureFormat::FLOAT)
+    {
+        return initTexture2D(id, n, m, channels);
+    }
+    TexelFormat f = texelFormat(format, channels);
+    glBindTexture(GL_TEXTURE_2D,id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        f.internalFormat,
+        textureWidth(format, n),
+        m,
+        0,
+        f.format,
+        f.type,
+        NULL
+    );
+}
+
+void transferToTexture2D(GLuint id, const void * data, uint64_t n, uint64_t m, uint64_t channels, TextureFormat format)
+{
+    TexelFormat f = texelFormat(format, channels);
+    glBindTexture(GL_TEXTURE_2D,id);
+    // rows of 8 and 16 bit texels need not be 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        textureWidth(format, n),
+        m,
+        f.format,
+        f.type,
+        data
+    );
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// a half open rectangle of texels [x0, x1) x [y0, y1), empty if x0 >= x1
+struct Region
+{
+    uint64_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+
+    void merge(const Region & r)
+    {
+        if (r.empty()) { return; }
+        if (empty()) { *this = r; return; }
+        x0 = std::min(x0, r.x0); y0 = std::min(y0, r.y0);
+        x1 = std::max(x1, r.x1); y1 = std::max(y1, r.y1);
+    }
+};
+
+// bytes per texel
+uint64_t texelBytes(TextureFormat format, uint64_t channels)
+{
+    switch (format)
+    {
+        case TextureFormat::FLOAT:
+            return 4*channels;
+        case TextureFormat::R8UI:
+            return 1;
+        case TextureFormat::R16UI:
+        case TextureFormat::RG8:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+/*
+    Upload the region r of an n x m attribute whose host data starts at
+    data.
+
+    Without an unpack buffer rows are read in place, no staging copy, by
+    telling GL the full row length and the offset of the region. With one,
+    of unpackBytes and no longer read by GL, the region's rows are
+    written into it unsynchronised and the texture update is sourced from
+    the buffer, so the driver can carry on with it after this returns.
+*/
+void transferRegionToTexture2D
+(
+    GLuint id,
+    const void * data,
+    uint64_t n,
+    Region r,
+    uint64_t channels,
+    TextureFormat format,
+    GLuint unpackBuffer = 0,
+    uint64_t unpackBytes = 0
+)
+{
+    if (r.empty()) { return; }
+    if (format == TextureFormat::PACKED_R32UI)
+    {
+        // whole texels of 32 cells
+        r.x0 = r.x0/32;
+        r.x1 = (r.x1+31)/32;
+    }
+    TexelFormat f = texelFormat(format, channels);
+    const uint64_t rowLength = textureWidth(format, n);
+    const uint64_t w = r.x1-r.x0;
+    const uint64_t h = r.y1-r.y0;
+
+    glBindTexture(GL_TEXTURE_2D,id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    const uint64_t bytes = texelBytes(format, channels);
+    if (unpackBuffer != 0 && w*h*bytes <= unpackBytes)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+        uint8_t * staging = static_cast<uint8_t*>
+        (
+            glMapBufferRange
+            (
+                GL_PIXEL_UNPACK_BUFFER, 0, w*h*bytes,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+            )
+        );
+        if (staging != nullptr)
+        {
+            const uint8_t * source = static_cast<const uint8_t*>(data);
+            for (uint64_t y = 0; y < h; y++)
+            {
+                std::memcpy(staging+y*w*bytes, source+((r.y0+y)*rowLength+r.x0)*bytes, w*bytes);
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.x0, r.y0, w, h, f.format, f.type, 0);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            return;
+        }
+        // could not map, upload directly
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y0);
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        r.x0,
+        r.y0,
+        w,
+        h,
+        f.format,
+        f.type,
+        data
+    );
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// read all of a texture into data, laid out as its host shadow
+void transferFromTexture2D(GLuint id, void * data, uint64_t channels, TextureFormat format)
+{
+    TexelFormat f = texelFormat(format, channels);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, f.format, f.type, data);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+// zero a texture a row at a time, without a host copy of the whole of it
+void clearTexture2D(GLuint id, uint64_t n, uint64_t m, uint64_t channels, TextureFormat format)
+{
+    TexelFormat f = texelFormat(format, channels);
+    const std::vector<uint8_t> zeros(textureWidth(format, n)*texelBytes(format, channels), 0);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (uint64_t y = 0; y < m; y++)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, textureWidth(format, n), 1, f.format, f.type, zeros.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// jGL only scrapes sampler2D uniforms, so integer samplers are set directly
+void setSamplerUniform(const char * name, GLint unit)
+{
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glUniform1i(glGetUniformLocation(program, name), unit);
+}
+
+// the host shadow of an attribute or output, only the one matching its format is allocated
+struct HostBuffer
+{
+    std::vector<float> floats;
+    std::vector<uint8_t> bytes;
+    std::vector<uint16_t> shorts;
+    std::vector<uint32_t> words;
+
+    HostBuffer() = default;
+
+    bool allocated() const
+    {
+        return !(floats.empty() && bytes.empty() && shorts.empty() && words.empty());
+    }
+
+    HostBuffer(TextureFormat format, uint64_t values)
+    {
+        switch (format)
+        {
+            case TextureFormat::FLOAT:
+                floats.resize(values, 0.0f); break;
+            case TextureFormat::R8UI:
+            case TextureFormat::RG8:
+                bytes.resize(values, 0); break;
+            case TextureFormat::R16UI:
+                shorts.resize(values, 0); break;
+            default:
+                words.resize(values, 0);
+        }
+    }
+
+    void * data(TextureFormat format)
+    {
+        switch (format)
+        {
+            case TextureFormat::FLOAT:
+                return floats.data();
+            case TextureFormat::R8UI:
+            case TextureFormat::RG8:
+                return bytes.data();
+            case TextureFormat::R16UI:
+                return shorts.data();
+            default:
+                return words.data();
+        }
+    }
+
+    template <class T> std::vector<T> & as();
+};
+
+template <> std::vector<float> & HostBuffer::as<float>() { return floats; }
+template <> std::vector<uint8_t> & HostBuffer::as<uint8_t>() { return bytes; }
+template <> std::vector<uint16_t> & HostBuffer::as<uint16_t>() { return shorts; }
+template <> std::vector<uint32_t> & HostBuffer::as<uint32_t>() { return words; }
+
+// whether T is the host shadow type of format
+template <class T> bool isHostType(TextureFormat format);
+
+template <> bool isHostType<float>(TextureFormat format) { return format == TextureFormat::FLOAT; }
+template <> bool isHostType<uint8_t>(TextureFormat format) { return format == TextureFormat::R8UI || format == TextureFormat::RG8; }
+template <> bool isHostType<uint16_t>(TextureFormat format) { return format == TextureFormat::R16UI; }
+template <> bool isHostType<uint32_t>(TextureFormat format) { return format == TextureFormat::R32UI || format == TextureFormat::PACKED_R32UI; }
+
 class glCompute
 {
 
@@ -161,6 +498,13 @@ public:
         uint64_t w;
         uint64_t h;
         uint64_t channels;
+        // ping-pong: output index compute() renders this attribute's
+        // next value into, swapping front and back, -1 for none
+        int pingPong = -1;
+        TextureFormat format = TextureFormat::FLOAT;
+        // device-resident: no host shadow is kept, get() and result()
+        // read the texture back into one allocated on first use
+        bool deviceOnly = false;
     };
 
     const char * vertexShader =
@@ -189,25 +533,63 @@ public:
         uint64_t n = attributeSize.size();
         textures.resize(n+outputs);
         glGenTextures(n+outputs, textures.data());
+        pingPong.resize(outputs, "");
+        targets.resize(outputs, 0);
         uint64_t t = 0;
         for (auto & attr : attributeSize)
         {
+            const AttributeDimension & d = attr.second;
             attributes[attr.first] = Attribute
             (
-                std::vector<float>(attr.second.w*attr.second.h*attr.second.channels, 0.0),
+                d.deviceOnly ? HostBuffer() : HostBuffer(d.format, hostValues(d.format, d.w, d.h, d.channels)),
                 textures[t],
-                attr.second.w,
-                attr.second.h,
-                attr.second.channels
+                d.w,
+                d.h,
+                d.channels,
+                d.format,
+                d.deviceOnly
             );
-            initTexture2D(textures[t], attr.second.w, attr.second.h, attr.second.channels);
+            initTexture2D(textures[t], d.w, d.h, d.channels, d.format);
+            if (d.deviceOnly) { clearTexture2D(textures[t], d.w, d.h, d.channels, d.format); }
             t++;
+
+            int o = attr.second.pingPong;
+            if (o >= 0)
+            {
+                if
+                (
+                    o >= outputs || pingPong[o] != "" ||
+                    attr.second.w != outputSize.w ||
+                    attr.second.h != outputSize.h ||
+                    attr.second.channels != outputSize.channels ||
+                    attr.second.format != outputSize.format ||
+                    attr.second.deviceOnly != outputSize.deviceOnly
+                )
+                {
+                    throw std::runtime_error("Invalid ping-pong attribute: "+attr.first);
+                }
+                GLuint back;
+                glGenTextures(1, &back);
+                initTexture2D(back, d.w, d.h, d.channels, d.format);
+                attributes[attr.first].back = back;
+                backTextures.push_back(back);
+                pingPong[o] = attr.first;
+            }
         }
         for (uint8_t o = 0; o < outputs; o++)
         {
-            initTexture2D(textures[n+o], outputSize.w, outputSize.h, outputSize.channels);
-            output.push_back(std::vector<float>(outputSize.w*outputSize.h*outputSize.channels, 0.0));
-            transferToTexture2D(textures[n+o], output[o], outputSize.w, outputSize.h, outputSize.channels);
+            const AttributeDimension & d = outputSize;
+            initTexture2D(textures[n+o], d.w, d.h, d.channels, d.format);
+            if (d.deviceOnly)
+            {
+                output.push_back(HostBuffer());
+                clearTexture2D(textures[n+o], d.w, d.h, d.channels, d.format);
+            }
+            else
+            {
+                output.push_back(HostBuffer(d.format, hostValues(d.format, d.w, d.h, d.channels)));
+                transferToTexture2D(textures[n+o], output[o].data(d.format), d.w, d.h, d.channels, d.format);
+            }
             drawBuffers.push_back(GL_COLOR_ATTACHMENT0+o);
         }
 
@@ -240,44 +622,111 @@ public:
 
     ~glCompute()
     {
-        glDeleteTextures(attributes.size(), textures.data());
+        glDeleteTextures(textures.size(), textures.data());
+        glDeleteTextures(backTextures.size(), backTextures.data());
+        for (Readback & r : readbacks)
+        {
+            glDeleteSync(r.fence);
+        }
+        if (!packBuffers.empty())
+        {
+            glDeleteBuffers(packBuffers.size(), packBuffers.data());
+        }
+        setUnpackBuffers(0);
         glDeleteFramebuffers(1, &frameBuffer);
         glDeleteBuffers(1, &vbo);
         glDeleteVertexArrays(1, &vao);
     }
 
-    void set(std::string attribute, std::vector<float> newData)
+    void set(std::string attribute, const std::vector<float> & newData)
     {
-        if (attributes.find(attribute) != attributes.end())
+        set(attribute, gsl::span<const float>(newData));
+    }
+
+    // integer formats, T matching the attribute's host shadow
+    template <class T>
+    void set(std::string attribute, const std::vector<T> & newData)
+    {
+        set(attribute, gsl::span<const T>(newData));
+    }
+
+    // copied straight into the host shadow, T matching its format
+    template <class T>
+    void set(std::string attribute, gsl::span<const T> newData)
+    {
+        auto it = attributes.find(attribute);
+        if
+        (
+            it != attributes.end() && it->second.deviceOnly &&
+            size_t(newData.size()) == it->second.values()
+        )
         {
-            if (newData.size() <= attributes[attribute].data.size())
-            {
-                std::copy
-                (
-                    newData.begin(),
-                    newData.end(),
-                    attributes[attribute].data.begin()
-                );
-            }
+            // nothing to keep on the host, upload it as is
+            return sync(attribute, newData);
         }
+        std::vector<T> & data = getAs<T>(attribute);
+        if (size_t(newData.size()) > data.size())
+        {
+            throw std::runtime_error("Wrong size of data for attribute: "+attribute);
+        }
+        std::copy(newData.begin(), newData.end(), data.begin());
     }
 
+    // one float, only the texel holding it uploaded at the next sync, or
+    // straight away to a device-only attribute
     void set(std::string attribute, float datum, uint64_t index)
     {
-        if (attributes.find(attribute) != attributes.end())
+        if (attributes.find(attribute) == attributes.end())
+        {
+            throw std::runtime_error("No attribute: "+attribute);
+        }
+        Attribute & attr = attributes[attribute];
+        if (attr.format != TextureFormat::FLOAT)
         {
-            if (index <= attributes[attribute].data.size())
+            throw std::runtime_error("Wrong type of data for attribute: "+attribute);
+        }
+        if (index >= attr.values()) { return; }
+        const uint64_t texel = index/attr.channels;
+        const uint64_t x = texel % attr.dimX;
+        const uint64_t y = texel / attr.dimX;
+        if (attr.deviceOnly)
+        {
+            // a texel's other channels are not on the host to write with it
+            if (attr.channels != 1)
             {
-                attributes[attribute].data[index] = datum;
+                throw std::runtime_error("Single values need one channel on device-only attribute: "+attribute);
             }
+            glBindTexture(GL_TEXTURE_2D, attr.texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, 1, 1, GL_RED, GL_FLOAT, &datum);
+            return;
         }
+        attr.data.floats[index] = datum;
+        attr.dirty.merge({x, y, x+1, y+1});
     }
 
+    // writable, so the whole attribute is uploaded at the next sync
     std::vector<float> & get(std::string attribute)
+    {
+        return getAs<float>(attribute);
+    }
+
+    template <class T>
+    std::vector<T> & getAs(std::string attribute)
     {
         if (attributes.find(attribute) != attributes.end())
         {
-            return attributes[attribute].data;
+            Attribute & attr = attributes[attribute];
+            if (!isHostType<T>(attr.format))
+            {
+                throw std::runtime_error("Wrong type of data for attribute: "+attribute);
+            }
+            if (attr.deviceOnly)
+            {
+                if (!attr.data.allocated()) { attr.data = HostBuffer(attr.format, attr.values()); }
+                transferFromTexture2D(attr.texture, attr.data.data(attr.format), attr.channels, attr.format);
+            }
+            attr.dirty = attr.whole();
+            return attr.data.as<T>();
         }
         throw std::runtime_error("No attribute: "+attribute);
     }
@@ -291,14 +740,25 @@ public:
         throw std::runtime_error("No attribute: "+attribute);
     }
 
-    const std::vector<float> & result(uint8_t index = 0) { return output[index]; }
+    const std::vector<float> & result(uint8_t index = 0) { return resultAs<float>(index); }
+
+    template <class T>
+    const std::vector<T> & resultAs(uint8_t index = 0)
+    {
+        if (outputSize.deviceOnly) { readOutput(index); }
+        return output[index].as<T>();
+    }
 
     void sync(std::string attribute)
     {
         if (attributes.find(attribute) != attributes.end())
         {
+            // only what changed since the last sync
             Attribute & attr = attributes[attribute];
-            transferToTexture2D(attr.texture, attr.data, attr.dimX, attr.dimY, attr.channels);
+            UnpackBuffer * unpack = nextUnpackBuffer();
+            transferRegionToTexture2D(attr.texture, attr.data.data(attr.format), attr.dimX, attr.dirty, attr.channels, attr.format, unpack ? unpack->buffer : 0, unpackBytes);
+            fenceUnpackBuffer(unpack);
+            attr.dirty = Region();
         }
     }
 
@@ -310,10 +770,171 @@ public:
         }
     }
 
-    GLuint outputTexture(uint8_t index = 0) { return textures[attributes.size()+index]; }
+    /*
+        Upload newData, laid out as the host shadow would be, straight to
+        the texture. The host shadow is neither read nor updated, so
+        get() no longer reflects the texture until the next set().
+    */
+    template <class T>
+    void sync(std::string attribute, gsl::span<const T> newData)
+    {
+        if (attributes.find(attribute) == attributes.end())
+        {
+            throw std::runtime_error("No attribute: "+attribute);
+        }
+        Attribute & attr = attributes[attribute];
+        if (!isHostType<T>(attr.format))
+        {
+            throw std::runtime_error("Wrong type of data for attribute: "+attribute);
+        }
+        if (size_t(newData.size()) != attr.values())
+        {
+            throw std::runtime_error("Wrong size of data for attribute: "+attribute);
+        }
+        UnpackBuffer * unpack = nextUnpackBuffer();
+        transferRegionToTexture2D(attr.texture, newData.data(), attr.dimX, attr.whole(), attr.channels, attr.format, unpack ? unpack->buffer : 0, unpackBytes);
+        fenceUnpackBuffer(unpack);
+        attr.dirty = Region();
+    }
+
+    /*
+        Stream uploads through a ring of count pixel unpack buffers, so
+        large syncs return before GL has read the data, 0 to upload
+        directly from host memory. Each is allocated once, at the size of
+        the largest attribute, and written unsynchronised only once the
+        fence after its last upload has signalled; if it has not, that
+        upload goes direct instead of waiting.
+    */
+    void setUnpackBuffers(unsigned count)
+    {
+        for (UnpackBuffer & u : unpackBuffers)
+        {
+            if (u.fence != nullptr) { glDeleteSync(u.fence); }
+            glDeleteBuffers(1, &u.buffer);
+        }
+        unpackBuffers.clear();
+        unpackIndex = 0;
+        unpackBytes = 0;
+        for (const auto & attr : attributes)
+        {
+            const Attribute & a = attr.second;
+            unpackBytes = std::max(unpackBytes, textureWidth(a.format, a.dimX)*a.dimY*texelBytes(a.format, a.channels));
+        }
+        for (unsigned i = 0; i < count; i++)
+        {
+            UnpackBuffer u {0, nullptr};
+            glGenBuffers(1, &u.buffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u.buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, unpackBytes, NULL, GL_STREAM_DRAW);
+            unpackBuffers.push_back(u);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    /*
+        Asynchronous readback through a ring of count pixel pack buffers.
+
+        readAsync starts a glReadPixels of an attribute's texture, or an
+        output's, into a free buffer and fences it. pollReadbacks, called
+        once a frame, hands each finished one to its callback in order as
+        a read-only view of the mapped buffer, valid only for the call.
+        With every buffer in flight readAsync returns false and reads
+        nothing, so a consumer drops samples instead of stalling.
+    */
+    void setPackBuffers(unsigned count)
+    {
+        pollReadbacks(true);
+        if (!packBuffers.empty())
+        {
+            glDeleteBuffers(packBuffers.size(), packBuffers.data());
+        }
+        packBuffers.assign(count, 0);
+        if (count > 0)
+        {
+            glGenBuffers(count, packBuffers.data());
+        }
+        freePackBuffers = packBuffers;
+    }
+
+    template <class T>
+    bool readAsync(std::string attribute, std::function<void(gsl::span<const T>)> callback)
+    {
+        if (attributes.find(attribute) == attributes.end())
+        {
+            throw std::runtime_error("No attribute: "+attribute);
+        }
+        const Attribute & attr = attributes[attribute];
+        return readAsync<T>(attr.texture, {attr.dimX, attr.dimY, attr.channels, -1, attr.format}, callback);
+    }
+
+    template <class T>
+    bool readAsync(uint8_t index, std::function<void(gsl::span<const T>)> callback)
+    {
+        return readAsync<T>(outputTexture(index), outputSize, callback);
+    }
+
+    // finished readbacks to their callbacks, all of them if wait
+    void pollReadbacks(bool wait = false)
+    {
+        while (!readbacks.empty())
+        {
+            Readback & r = readbacks.front();
+            GLenum status = glClientWaitSync
+            (
+                r.fence,
+                GL_SYNC_FLUSH_COMMANDS_BIT,
+                wait ? GLuint64(1000000000) : GLuint64(0)
+            );
+            if (status == GL_TIMEOUT_EXPIRED && !wait) { return; }
+            glDeleteSync(r.fence);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+            const void * view = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, r.bytes, GL_MAP_READ_BIT);
+            if (view != nullptr && status != GL_WAIT_FAILED)
+            {
+                r.callback(view);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            freePackBuffers.push_back(r.buffer);
+            readbacks.pop_front();
+        }
+    }
+
+    // the latest result, the front buffer when written to a ping-pong attribute
+    GLuint outputTexture(uint8_t index = 0)
+    {
+        if (pingPong[index] != "") { return attributes[pingPong[index]].texture; }
+        if (targets[index] != 0) { return targets[index]; }
+        return textures[attributes.size()+index];
+    }
+
+    /*
+        Render output index straight into texture, owned elsewhere, such
+        as another glCompute's attribute, so one pass feeds the next
+        without a copy. It must match the output's size and format. 0
+        renders into the output's own texture again.
+    */
+    void renderInto(uint8_t index, GLuint texture)
+    {
+        if (index >= outputs || pingPong[index] != "")
+        {
+            throw std::runtime_error("Cannot render output "+std::to_string(index)+" into another texture");
+        }
+        targets[index] = texture;
+    }
+
+    // time and trace compute() as name and glCopyTexture() as name copy, a null timer only traces
+    void setTimer(PassTimer * timer, std::string name)
+    {
+        this->timer = timer;
+        this->name = name;
+        copyName = name+" copy";
+    }
 
     void glCopyTexture(GLuint from, GLuint to, glm::vec2 size)
     {
+        PassTimer::Scope scope(timer, copyName);
+        Trace::Scope trace(copyName.c_str());
         copyShader.use();
         glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
 
@@ -353,22 +974,27 @@ public:
 
     void compute(bool syncResult)
     {
+        PassTimer::Scope scope(timer, name);
+        Trace::Scope trace(name.c_str());
         shader.use();
 
         glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
 
         for (uint8_t o = 0; o < outputs; o++)
         {
+            GLuint target = textures[attributes.size()+o];
+            if (pingPong[o] != "") { target = attributes[pingPong[o]].back; }
+            else if (targets[o] != 0) { target = targets[o]; }
 
             glActiveTexture(GL_TEXTURE1+o);
-            glBindTexture(GL_TEXTURE_2D, textures[attributes.size()+o]);
+            glBindTexture(GL_TEXTURE_2D, target);
 
             glFramebufferTexture2D
             (
                 GL_FRAMEBUFFER,
                 GL_COLOR_ATTACHMENT0+o,
                 GL_TEXTURE_2D,
-                textures[attributes.size()+o],
+                target,
                 0
             );
         }
@@ -380,7 +1006,14 @@ public:
         {
             glActiveTexture(GL_TEXTURE0+t+outputs+1);
             glBindTexture(GL_TEXTURE_2D, attr.second.texture);
-            shader.setUniform(attr.first, jGL::Sampler2D(t+outputs+1));
+            if (isInteger(attr.second.format))
+            {
+                setSamplerUniform(attr.first.c_str(), t+outputs+1);
+            }
+            else
+            {
+                shader.setUniform(attr.first, jGL::Sampler2D(t+outputs+1));
+            }
             t++;
         }
 
@@ -395,15 +1028,21 @@ public:
         glViewport(0, 0, outputSize.w, outputSize.h);
         glDrawArrays(GL_TRIANGLES, 0, 6);
 
+        for (const std::string & name : pingPong)
+        {
+            if (name != "")
+            {
+                Attribute & attr = attributes[name];
+                std::swap(attr.texture, attr.back);
+            }
+        }
+
         if (syncResult)
         {
             for (uint8_t o = 0; o < outputs; o++)
             {
                 glActiveTexture(GL_TEXTURE1+o);
-                glBindTexture(GL_TEXTURE_2D, textures[attributes.size()+o]);
-                GLuint type = GL_RED;
-                if (outputSize.channels == 4) { type = GL_RGBA; }
-                glGetTexImage(GL_TEXTURE_2D, 0, type, GL_FLOAT, output[o].data());
+                readOutput(o);
             }
         }
 
@@ -438,27 +1077,143 @@ private:
 
         Attribute
         (
-            std::vector<float> data,
+            HostBuffer data,
             GLuint texture,
             uint64_t dimX,
             uint64_t dimY,
-            uint64_t channels
+            uint64_t channels,
+            TextureFormat format,
+            bool deviceOnly
         )
-        : data(data), texture(texture), dimX(dimX), dimY(dimY), channels(channels)
+        : data(data), texture(texture), back(0), dimX(dimX), dimY(dimY), channels(channels), format(format),
+          deviceOnly(deviceOnly), dirty(deviceOnly ? Region() : whole())
         {}
 
-        std::vector<float> data;
+        Region whole() const { return {0, 0, dimX, dimY}; }
+        uint64_t values() const { return hostValues(format, dimX, dimY, channels); }
+
+        HostBuffer data;
+        // front (read) and, if ping-pong, back (render target) textures
         GLuint texture;
+        GLuint back;
         uint64_t dimX;
         uint64_t dimY;
         uint64_t channels;
+        TextureFormat format;
+        bool deviceOnly;
+        // texels changed since the last sync
+        Region dirty;
     };
 
     std::vector<GLuint> textures;
+    std::vector<GLuint> backTextures;
     std::map<std::string, Attribute> attributes;
+    // attribute each output writes to, "" if its own output texture
+    std::vector<std::string> pingPong;
+    // texture each output renders into instead of its own, 0 for none
+    std::vector<GLuint> targets;
 
-    std::vector<std::vector<float>> output;
+    std::vector<HostBuffer> output;
     uint8_t outputs;
+    PassTimer * timer = nullptr;
+    std::string name = "glCompute";
+    std::string copyName = "glCompute copy";
+    struct UnpackBuffer
+    {
+        GLuint buffer;
+        // the last upload sourced from it, nullptr once GL has read it
+        GLsync fence;
+    };
+
+    std::vector<UnpackBuffer> unpackBuffers;
+    unsigned unpackIndex = 0;
+    uint64_t unpackBytes = 0;
+
+    struct Readback
+    {
+        GLuint buffer;
+        GLsync fence;
+        uint64_t bytes;
+        std::function<void(const void *)> callback;
+    };
+
+    std::vector<GLuint> packBuffers;
+    std::vector<GLuint> freePackBuffers;
+    std::deque<Readback> readbacks;
+
+    template <class T>
+    bool readAsync(GLuint texture, AttributeDimension d, std::function<void(gsl::span<const T>)> callback)
+    {
+        if (freePackBuffers.empty()) { return false; }
+        const uint64_t values = hostValues(d.format, d.w, d.h, d.channels);
+        const uint64_t bytes = textureWidth(d.format, d.w)*d.h*texelBytes(d.format, d.channels);
+        if (values*sizeof(T) != bytes)
+        {
+            throw std::runtime_error("Readback type does not match the texture format");
+        }
+        GLuint buffer = freePackBuffers.back();
+        freePackBuffers.pop_back();
+
+        GLint bound = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+        glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+        TexelFormat f = texelFormat(d.format, d.channels);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, textureWidth(d.format, d.w), d.h, f.format, f.type, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, bound);
+
+        readbacks.push_back
+        (
+            {
+                buffer,
+                glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+                bytes,
+                [callback, values](const void * view)
+                {
+                    callback(gsl::span<const T>(static_cast<const T*>(view), values));
+                }
+            }
+        );
+        return true;
+    }
+
+    void readOutput(uint8_t o)
+    {
+        if (!output[o].allocated())
+        {
+            output[o] = HostBuffer(outputSize.format, hostValues(outputSize.format, outputSize.w, outputSize.h, outputSize.channels));
+        }
+        transferFromTexture2D(outputTexture(o), output[o].data(outputSize.format), outputSize.channels, outputSize.format);
+    }
+
+    // the next buffer of the ring if GL is done reading it, else nullptr
+    // to upload directly rather than wait
+    UnpackBuffer * nextUnpackBuffer()
+    {
+        if (unpackBuffers.empty()) { return nullptr; }
+        UnpackBuffer & u = unpackBuffers[unpackIndex];
+        if (u.fence != nullptr)
+        {
+            if (glClientWaitSync(u.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) { return nullptr; }
+            glDeleteSync(u.fence);
+            u.fence = nullptr;
+        }
+        unpackIndex = (unpackIndex+1) % unpackBuffers.size();
+        return &u;
+    }
+
+    void fenceUnpackBuffer(UnpackBuffer * u)
+    {
+        if (u != nullptr) { u->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); }
+    }
+
     AttributeDimension outputSize;
     GLuint frameBuffer, vao, vbo;
     std::vector<GLenum> drawBuffers;
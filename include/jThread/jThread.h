@@ -6,8 +6,15 @@
 #include <condition_variable>
 #include <queue>
 #include <functional>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <exception>
+#include <algorithm>
 #include <assert.h> 
 
+#include <trace.h>
+
 /*
 
       jThread a quick and dirty header only multi-threading library 
@@ -48,21 +55,210 @@
 
     pool.queueJob(std::bind(work,std::ref(a),std::ref(b),std::ref(c2))); - enqueue the function, work, with 3 arguments (as references)
 
-    pool.wait() - waits until all jobs are done
+    pool.wait() - waits until all jobs are done, sleeping after a short spin, rethrows the first exception a job threw
     pool.stop() - stops (joins) threads (will interrupt threads if the have not already consumed a job on the queue)
 
+    ThreadPool pool(n, Schedule::WORK_STEALING) - each worker owns a Chase-Lev deque, jobs queued from inside a
+      worker go lock free onto its own deque and idle workers steal from random victims. Jobs queued from
+      other threads go on the shared queue, which workers check after their own deque.
+
+        Chase and Lev, Dynamic circular work-stealing deque, SPAA 2005
+        Le et al., Correct and efficient work-stealing for weak memory models, PPoPP 2013
+
+    pool.parallel_for(begin, end, grain, fn) - calls fn(i) for i in [begin, end), grain indices per job, the
+      calling thread takes chunks too and returns once all are done, rethrowing the first exception
+
+    TaskGroup group(pool); group.run(fn); group.wait(); - fork-join on a subset of the pool's jobs
+
+    Latch latch(n); latch.countDown(); latch.wait(); - single use count down, wait spins briefly then blocks
+
 */
 namespace jThread
 {
 
+  enum class Schedule {SHARED_QUEUE, WORK_STEALING};
+
+  // iterations to poll before blocking in a wait
+  const unsigned WAIT_SPINS = 64;
+
+  class Latch
+  {
+
+  public:
+
+      Latch(size_t count)
+      : count(count)
+      {}
+
+      void add(size_t n = 1)
+      {
+        count += n;
+      }
+
+      void countDown()
+      {
+        // under the lock so a waiter cannot return and destroy the latch mid notify
+        std::unique_lock<std::mutex> lock(mutex);
+        if (--count == 0)
+        {
+          condition.notify_all();
+        }
+      }
+
+      bool done() const { return count.load() == 0; }
+
+      void wait()
+      {
+        for (unsigned i = 0; i < WAIT_SPINS && !done(); i++)
+        {
+          std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(
+          lock, [this] {return done();}
+        );
+      }
+
+  private:
+
+    std::atomic<size_t> count;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+  };
+
+  /*
+    Single owner deque, the owner pushes and pops at the bottom, any thread
+    may steal from the top. Grows when full, retired buffers are kept until
+    destruction since a thief may still be reading one.
+  */
+  template <class T>
+  class WorkStealingDeque
+  {
+
+  public:
+
+      WorkStealingDeque(size_t capacity = 1024)
+      : top(0), bottom(0)
+      {
+        buffers.emplace_back(std::make_unique<Buffer>(capacity));
+        buffer.store(buffers.back().get(), std::memory_order_relaxed);
+      }
+
+      // owner only
+      void push(T x)
+      {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Buffer * a = buffer.load(std::memory_order_relaxed);
+        if (b-t > int64_t(a->capacity)-1)
+        {
+          a = grow(a, t, b);
+        }
+        a->put(b, x);
+        bottom.store(b+1, std::memory_order_release);
+      }
+
+      // owner only
+      bool pop(T & x)
+      {
+        int64_t b = bottom.load(std::memory_order_relaxed)-1;
+        Buffer * a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+          bottom.store(b+1, std::memory_order_relaxed);
+          return false;
+        }
+
+        x = a->get(b);
+        if (t == b)
+        {
+          // last item, race any thieves for it
+          bool won = top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed);
+          bottom.store(b+1, std::memory_order_relaxed);
+          return won;
+        }
+        return true;
+      }
+
+      // any thread
+      bool steal(T & x)
+      {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+        {
+          return false;
+        }
+
+        Buffer * a = buffer.load(std::memory_order_acquire);
+        x = a->get(t);
+        return top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      }
+
+      bool empty() const
+      {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+      }
+
+  private:
+
+    struct Buffer
+    {
+      Buffer(size_t capacity)
+      : capacity(capacity), mask(capacity-1), items(new std::atomic<T>[capacity])
+      {
+        assert((capacity & mask) == 0);
+      }
+
+      T get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+      void put(int64_t i, T x) { items[i & mask].store(x, std::memory_order_relaxed); }
+
+      const size_t capacity;
+      const size_t mask;
+      std::unique_ptr<std::atomic<T>[]> items;
+    };
+
+    Buffer * grow(Buffer * a, int64_t t, int64_t b)
+    {
+      buffers.emplace_back(std::make_unique<Buffer>(2*a->capacity));
+      Buffer * bigger = buffers.back().get();
+      for (int64_t i = t; i < b; i++)
+      {
+        bigger->put(i, a->get(i));
+      }
+      buffer.store(bigger, std::memory_order_release);
+      return bigger;
+    }
+
+    std::atomic<int64_t> top, bottom;
+    std::atomic<Buffer*> buffer;
+    std::vector<std::unique_ptr<Buffer>> buffers;
+
+  };
+
   class ThreadPool 
   {
 
   public:
 
-      ThreadPool(size_t n)
-      : nThreads(n), terminate(false), working(0)
+      ThreadPool(size_t n, Schedule schedule = Schedule::SHARED_QUEUE)
+      : nThreads(n), schedule(schedule), terminate(false), working(0), pending(0), sleeping(0), queued(0)
       {
+        if (schedule == Schedule::WORK_STEALING)
+        {
+          // one deque per possible worker, so jobs left by a joined thread can still be stolen
+          for (unsigned i = 0; i < n; i++)
+          {
+            deques.emplace_back(std::make_unique<WorkStealingDeque<Job*>>());
+          }
+        }
         threads.resize(n);
         for (unsigned i = 0; i < n; i++)
         {
@@ -72,6 +268,11 @@ namespace jThread
 
       void queueJob(const std::function<void(void)> & job)
       {
+        if (schedule == Schedule::WORK_STEALING)
+        {
+          queueStealableJob(job);
+          return;
+        }
         {
           std::unique_lock<std::mutex> lock(queueLock);
           jobs.emplace(std::move(job));
@@ -83,6 +284,10 @@ namespace jThread
 
       bool busy()
       {
+        if (schedule == Schedule::WORK_STEALING)
+        {
+          return working.load() > 0;
+        }
         bool b = false;
         {
           std::unique_lock<std::mutex> lock(queueLock);
@@ -94,9 +299,92 @@ namespace jThread
 
       void wait()
       {
-        while (busy())
+        for (unsigned i = 0; i < WAIT_SPINS && working.load() > 0; i++)
         {
-          //void
+          std::this_thread::yield();
+        }
+        std::exception_ptr e;
+        {
+          std::unique_lock<std::mutex> lock(queueLock);
+          doneCondition.wait(
+            lock, [this] {return working.load() == 0;}
+          );
+          std::swap(e, error);
+        } // release mutex
+        if (e)
+        {
+          std::rethrow_exception(e);
+        }
+      }
+
+      template <class F>
+      void parallel_for(size_t begin, size_t end, size_t grain, F fn)
+      {
+        if (end <= begin)
+        {
+          return;
+        }
+        grain = std::max(grain, size_t(1));
+
+        /*
+          Joined per chunk rather than per helper job, so helpers that only
+          start once everything is done (e.g. the pool is busy in nested
+          calls) just find no chunks. They can outlive this call, hence the
+          shared state.
+        */
+        struct State
+        {
+          State(size_t chunks)
+          : chunks(chunks), next(0), failed(false), latch(chunks)
+          {}
+
+          const size_t chunks;
+          std::atomic<size_t> next;
+          std::atomic<bool> failed;
+          std::exception_ptr error;
+          std::mutex errorLock;
+          Latch latch;
+        };
+
+        auto state = std::make_shared<State>((end-begin+grain-1)/grain);
+        const F * f = &fn;
+
+        auto work = [state, f, begin, end, grain]()
+        {
+          size_t c;
+          while ((c = state->next.fetch_add(1)) < state->chunks)
+          {
+            if (!state->failed)
+            {
+              try
+              {
+                for (size_t i = begin+c*grain; i < std::min(end, begin+(c+1)*grain); i++)
+                {
+                  (*f)(i);
+                }
+              }
+              catch (...)
+              {
+                std::unique_lock<std::mutex> lock(state->errorLock);
+                if (!state->error) { state->error = std::current_exception(); }
+                state->failed = true;
+              }
+            }
+            state->latch.countDown();
+          }
+        };
+
+        const size_t helpers = std::min(state->chunks-1, size());
+        for (size_t h = 0; h < helpers; h++)
+        {
+          queueJob(work);
+        }
+        work();
+        state->latch.wait();
+
+        if (state->error)
+        {
+          std::rethrow_exception(state->error);
         }
       }
 
@@ -112,11 +400,20 @@ namespace jThread
           t.join();
         }
         threads.clear();
+        started = 0;
       }
 
       ~ThreadPool()
       {
           stop();
+          for (auto & deque : deques)
+          {
+            Job * job;
+            while (deque->steal(job))
+            {
+              delete job;
+            }
+          }
       }
 
       void joinThread()
@@ -161,10 +458,21 @@ namespace jThread
 
       size_t size(){return threads.size();}
 
+      Schedule getSchedule() const { return schedule; }
+
   private:
 
+    typedef std::function<void(void)> Job;
+
     void main()
     {
+      if (Trace::isEnabled()) { Trace::setThreadName("jThread worker"); }
+      if (schedule == Schedule::WORK_STEALING)
+      {
+        stealingMain();
+        return;
+      }
+
       while (true)
       {
         std::function<void(void)> job;
@@ -184,28 +492,220 @@ namespace jThread
           jobs.pop();
         } // release mutex
 
-        job();
+        run(job);
 
         {
           std::unique_lock<std::mutex> lock(queueLock);
           // decrement work being done/to do
-          working--;
+          if (--working == 0)
+          {
+            doneCondition.notify_all();
+          }
         }
       }
     }
 
+    void run(Job & job)
+    {
+      try
+      {
+        Trace::Scope scope("job");
+        job();
+      }
+      catch (...)
+      {
+        std::unique_lock<std::mutex> lock(queueLock);
+        if (!error) { error = std::current_exception(); }
+      }
+    }
+
+    // the pool and deque index of the calling thread, if it is a worker
+    static std::pair<ThreadPool*, size_t> & self()
+    {
+      static thread_local std::pair<ThreadPool*, size_t> worker(nullptr, 0);
+      return worker;
+    }
+
+    void queueStealableJob(const Job & job)
+    {
+      working++;
+      std::pair<ThreadPool*, size_t> & worker = self();
+      if (worker.first == this)
+      {
+        deques[worker.second]->push(new Job(job));
+      }
+      else
+      {
+        std::unique_lock<std::mutex> lock(queueLock);
+        jobs.emplace(job);
+        queued++;
+      }
+      pending++;
+      // pending is published before sleeping is read, and sleepers count
+      // themselves before checking pending, so a wakeup cannot be missed
+      if (sleeping.load() > 0)
+      {
+        { std::unique_lock<std::mutex> lock(queueLock); }
+        queueCondition.notify_one();
+      }
+    }
+
+    bool findJob(size_t i, std::minstd_rand & rng, Job & job)
+    {
+      Job * stolen = nullptr;
+      if (deques[i]->pop(stolen))
+      {
+        job = std::move(*stolen);
+        delete stolen;
+        return true;
+      }
+
+      if (queued.load() > 0)
+      {
+        std::unique_lock<std::mutex> lock(queueLock);
+        if (!jobs.empty())
+        {
+          job = std::move(jobs.front());
+          jobs.pop();
+          queued--;
+          return true;
+        }
+      }
+
+      const size_t n = deques.size();
+      for (size_t k = 0; k < n; k++)
+      {
+        size_t victim = rng() % n;
+        if (victim != i && deques[victim]->steal(stolen))
+        {
+          job = std::move(*stolen);
+          delete stolen;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void stealingMain()
+    {
+      size_t i = 0;
+      {
+        std::unique_lock<std::mutex> lock(queueLock);
+        i = started++ % deques.size();
+      }
+      self() = {this, i};
+      std::minstd_rand rng(i+1);
+      unsigned idle = 0;
+
+      while (!terminate)
+      {
+        Job job;
+        if (findJob(i, rng, job))
+        {
+          idle = 0;
+          pending--;
+          run(job);
+          if (--working == 0)
+          {
+            std::unique_lock<std::mutex> lock(queueLock);
+            doneCondition.notify_all();
+          }
+          continue;
+        }
+
+        if (++idle < WAIT_SPINS)
+        {
+          std::this_thread::yield();
+          continue;
+        }
+
+        std::unique_lock<std::mutex> lock(queueLock);
+        sleeping++;
+        queueCondition.wait(
+          lock, [this] {return pending.load() > 0 || terminate;}
+        );
+        sleeping--;
+        idle = 0;
+      }
+      self() = {nullptr, 0};
+    }
+
     const size_t nThreads;
+    const Schedule schedule;
 
-    bool terminate;
+    std::atomic<bool> terminate;
 
     std::queue<std::function<void(void)>> jobs;
     std::vector<std::thread> threads;
 
-    size_t working;
+    std::atomic<size_t> working;
+
+    std::vector<std::unique_ptr<WorkStealingDeque<Job*>>> deques;
+    std::atomic<size_t> pending, sleeping, queued;
+    size_t started = 0;
 
     std::mutex queueLock;
     std::condition_variable queueCondition;
+    std::condition_variable doneCondition;
+
+    std::exception_ptr error;
     
   };
+
+  class TaskGroup
+  {
+
+  public:
+
+      TaskGroup(ThreadPool & pool)
+      : pool(pool), latch(0)
+      {}
+
+      ~TaskGroup()
+      {
+        latch.wait();
+      }
+
+      template <class F>
+      void run(F fn)
+      {
+        latch.add();
+        pool.queueJob
+        (
+          [this, fn]()
+          {
+            try
+            {
+              fn();
+            }
+            catch (...)
+            {
+              std::unique_lock<std::mutex> lock(errorLock);
+              if (!error) { error = std::current_exception(); }
+            }
+            latch.countDown();
+          }
+        );
+      }
+
+      void wait()
+      {
+        latch.wait();
+        if (error)
+        {
+          std::exception_ptr e = error;
+          error = nullptr;
+          std::rethrow_exception(e);
+        }
+      }
+
+  private:
+
+    ThreadPool & pool;
+    Latch latch;
+    std::exception_ptr error;
+    std::mutex errorLock;
+
+  };
 }
 #endif /* THREADPOOL_H */
@@ -0,0 +1,222 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+/*
+
+    A record of everything that steered a run: the master seed and each
+    input event tagged with the step it took effect before. Replaying the
+    events at the same steps, from the same starting world and seed,
+    reproduces the run exactly, at any frame rate.
+
+        "SNOWJRNL"      magic
+        uint32          version
+        uint64          seed
+        uint64          events
+
+    then per event
+
+        varint          steps since the previous event
+        uint8           Type
+        BRUSH only:
+        zigzag varint   x0, y0, x1 - x0, y1 - y0
+        float           value
+
+    All little endian. A journal ends with an END event at the step the
+    run stopped.
+
+*/
+
+class Journal
+{
+
+public:
+
+    enum class Type : uint8_t { BRUSH, RESET, PAUSE, END };
+
+    struct Event
+    {
+        uint64_t step;
+        Type type;
+        // inclusive brush rectangle of cells, may wrap past the grid's edges
+        int32_t x0, y0, x1, y1;
+        float value;
+    };
+
+    Journal(uint64_t seed = 0)
+    : seed(seed)
+    {}
+
+    uint64_t getSeed() const { return seed; }
+
+    const std::vector<Event> & getEvents() const { return events; }
+
+    void brush(uint64_t step, int32_t x0, int32_t y0, int32_t x1, int32_t y1, float value)
+    {
+        record({step, Type::BRUSH, x0, y0, x1, y1, value});
+    }
+
+    void reset(uint64_t step) { record({step, Type::RESET, 0, 0, 0, 0, 0.0f}); }
+
+    void pause(uint64_t step) { record({step, Type::PAUSE, 0, 0, 0, 0, 0.0f}); }
+
+    void end(uint64_t step) { record({step, Type::END, 0, 0, 0, 0, 0.0f}); }
+
+    // step of the END event, or of the last event if there is none
+    uint64_t endStep() const { return events.empty() ? 0 : events.back().step; }
+
+    void save(std::string path) const
+    {
+        std::vector<uint8_t> out(MAGIC, MAGIC+8);
+        putFixed(out, VERSION, 4);
+        putFixed(out, seed, 8);
+        putFixed(out, events.size(), 8);
+        uint64_t last = 0;
+        for (const Event & e : events)
+        {
+            putVarint(out, e.step-last);
+            last = e.step;
+            out.push_back(uint8_t(e.type));
+            if (e.type == Type::BRUSH)
+            {
+                putZigzag(out, e.x0);
+                putZigzag(out, e.y0);
+                putZigzag(out, int64_t(e.x1)-e.x0);
+                putZigzag(out, int64_t(e.y1)-e.y0);
+                uint32_t v;
+                std::memcpy(&v, &e.value, sizeof(v));
+                putFixed(out, v, 4);
+            }
+        }
+
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(out.data()), out.size());
+        if (!file.good())
+        {
+            throw std::runtime_error("Could not write journal "+path);
+        }
+    }
+
+    static Journal load(std::string path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+        {
+            throw std::runtime_error("Could not open journal "+path);
+        }
+        const std::vector<uint8_t> in
+        (
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>()
+        );
+        size_t i = 0;
+        if (in.size() < 28 || std::memcmp(in.data(), MAGIC, 8) != 0)
+        {
+            throw std::runtime_error(path+" is not a journal");
+        }
+        i = 8;
+        if (getFixed(in, i, 4) != VERSION)
+        {
+            throw std::runtime_error("Unsupported journal version in "+path);
+        }
+
+        Journal journal(getFixed(in, i, 8));
+        const uint64_t n = getFixed(in, i, 8);
+        uint64_t step = 0;
+        for (uint64_t k = 0; k < n; k++)
+        {
+            Event e {0, Type::END, 0, 0, 0, 0, 0.0f};
+            step += getVarint(in, i);
+            e.step = step;
+            if (i >= in.size() || in[i] > uint8_t(Type::END))
+            {
+                throw std::runtime_error("Corrupt journal "+path);
+            }
+            e.type = Type(in[i++]);
+            if (e.type == Type::BRUSH)
+            {
+                e.x0 = getZigzag(in, i);
+                e.y0 = getZigzag(in, i);
+                e.x1 = e.x0+getZigzag(in, i);
+                e.y1 = e.y0+getZigzag(in, i);
+                const uint32_t v = getFixed(in, i, 4);
+                std::memcpy(&e.value, &v, sizeof(v));
+            }
+            journal.events.push_back(e);
+        }
+        return journal;
+    }
+
+private:
+
+    static constexpr char MAGIC[8] = {'S', 'N', 'O', 'W', 'J', 'R', 'N', 'L'};
+    static const uint32_t VERSION = 2;
+
+    uint64_t seed;
+    std::vector<Event> events;
+
+    void record(Event e)
+    {
+        if (!events.empty() && e.step < events.back().step)
+        {
+            throw std::runtime_error("Journal events must be recorded in step order");
+        }
+        events.push_back(e);
+    }
+
+    static void putFixed(std::vector<uint8_t> & out, uint64_t v, unsigned bytes)
+    {
+        for (unsigned b = 0; b < bytes; b++) { out.push_back(uint8_t(v >> (8*b))); }
+    }
+
+    static void putVarint(std::vector<uint8_t> & out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(uint8_t(v));
+    }
+
+    static void putZigzag(std::vector<uint8_t> & out, int64_t v)
+    {
+        putVarint(out, (uint64_t(v) << 1) ^ uint64_t(v >> 63));
+    }
+
+    static uint64_t getFixed(const std::vector<uint8_t> & in, size_t & i, unsigned bytes)
+    {
+        if (i+bytes > in.size()) { throw std::runtime_error("Journal is truncated"); }
+        uint64_t v = 0;
+        for (unsigned b = 0; b < bytes; b++) { v |= uint64_t(in[i++]) << (8*b); }
+        return v;
+    }
+
+    static uint64_t getVarint(const std::vector<uint8_t> & in, size_t & i)
+    {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (i >= in.size()) { throw std::runtime_error("Journal is truncated"); }
+            const uint8_t b = in[i++];
+            v |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) { return v; }
+        }
+        throw std::runtime_error("Corrupt journal varint");
+    }
+
+    static int64_t getZigzag(const std::vector<uint8_t> & in, size_t & i)
+    {
+        const uint64_t v = getVarint(in, i);
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+};
+
+#endif /* JOURNAL_H */
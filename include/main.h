@@ -13,11 +13,17 @@
 #include <jLog/jLog.h>
 
 #include <rand.h>
+#include <philox.h>
 #include <algorithm>
 #include <chrono>
 #include <sstream>
 
 #include <glCompute.h>
+#include <offscreenDisplay.h>
+#include <benchmark.h>
+#include <checkpoint.h>
+#include <journal.h>
+#include <frameRecorder.h>
 
 using namespace std::chrono;
 
@@ -53,10 +59,74 @@ std::string fixedLengthNumber(double x, unsigned length)
     return dtrunc;
 }
 
+// a window, or an offscreen context when headless, behind the same isOpen()/loop()
+class Window
+{
+public:
+
+    Window(glm::ivec2 res, const char * title, jGL::DesktopDisplay::Config conf, bool headless)
+    {
+        if (headless)
+        {
+            offscreen = std::make_unique<OffscreenDisplay>(res);
+        }
+        else
+        {
+            desktop = std::make_unique<jGL::DesktopDisplay>(res, title, conf);
+        }
+    }
+
+    bool isOpen() { return desktop ? desktop->isOpen() : offscreen->isOpen(); }
+
+    void close()
+    {
+        if (desktop) { desktop->close(); }
+        else { offscreen->close(); }
+    }
+
+    void loop()
+    {
+        if (desktop) { desktop->loop(); }
+        else { offscreen->loop(); }
+    }
+
+    void setFrameLimit(unsigned fps)
+    {
+        if (desktop) { desktop->setFrameLimit(fps); }
+        else { offscreen->setFrameLimit(fps); }
+    }
+
+    void setVsync(bool on)
+    {
+        if (desktop) { glfwSwapInterval(on ? 1 : 0); }
+        else { offscreen->setVsync(on); }
+    }
+
+    bool keyHasEvent(int key, jGL::EventType action)
+    {
+        return desktop ? desktop->keyHasEvent(key, action) : offscreen->keyHasEvent(key, action);
+    }
+
+    void mousePosition(double & x, double & y)
+    {
+        if (desktop) { desktop->mousePosition(x, y); }
+        else { offscreen->mousePosition(x, y); }
+    }
+
+    bool isHeadless() const { return offscreen != nullptr; }
+
+    std::string getBackend() const { return desktop ? "GLFW" : offscreen->getBackend(); }
+
+private:
+
+    std::unique_ptr<jGL::DesktopDisplay> desktop;
+    std::unique_ptr<OffscreenDisplay> offscreen;
+};
+
 struct Visualise
 {
-    Visualise(GLuint particlesTexture, GLuint obstaclesTexture)
-    : particlesTexture(particlesTexture), obstaclesTexture(obstaclesTexture)
+    Visualise(GLuint particlesTexture, GLuint obstaclesTexture, bool integerParticles = false)
+    : particlesTexture(particlesTexture), obstaclesTexture(obstaclesTexture), integerParticles(integerParticles)
     {
         glGenVertexArrays(1, &pvao);
         glBindVertexArray(pvao);
@@ -114,10 +184,20 @@ struct Visualise
     {
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, particlesTexture);
-        shader = jGL::GL::glShader(vertexShader, fragmentShader);
-        shader.compile();
-        shader.use();
-        shader.setUniform("tex", jGL::Sampler2D(1));
+        if (integerParticles)
+        {
+            shader = jGL::GL::glShader(vertexShader, integerFragmentShader);
+            shader.compile();
+            shader.use();
+            setSamplerUniform("tex", 1);
+        }
+        else
+        {
+            shader = jGL::GL::glShader(vertexShader, fragmentShader);
+            shader.compile();
+            shader.use();
+            shader.setUniform("tex", jGL::Sampler2D(1));
+        }
         shader.setUniform("proj", proj);
 
         glBindVertexArray(qvao);
@@ -144,6 +224,7 @@ struct Visualise
 
     jGL::GL::glShader shader;
     GLuint particlesTexture, obstaclesTexture, pvao, pvbo, qvao, qvbo, frameBuffer;
+    bool integerParticles;
     float p[2] =
     {
         0.0f,0.0f
@@ -181,29 +262,44 @@ struct Visualise
     "   if (t.r == 0) { discard; }\n"
     "   colour = vec4(1.0,1.0,1.0,t.r);\n"
     "}";
+
+    // for R8UI cells, integer textures cannot be filtered so are fetched
+    const char * integerFragmentShader =
+    "#version " GLSL_VERSION "\n"
+    "uniform highp usampler2D tex;\n"
+    "in vec2 o_texCoords;\n"
+    "out vec4 colour;\n"
+    "void main(void){\n"
+    "   ivec2 size = textureSize(tex, 0);\n"
+    "   uint t = texelFetch(tex, min(ivec2(o_texCoords*vec2(size)), size-1), 0).r;\n"
+    "   if (t == 0u) { discard; }\n"
+    "   colour = vec4(1.0,1.0,1.0,1.0);\n"
+    "}";
 };
 
+// for a glCompute that only holds attributes and is never computed
+const char * holdShader =
+    "#version " GLSL_VERSION "\n"
+    "precision highp float;\n"
+    "layout(location=0) out vec4 result;\n"
+    "void main(){\n"
+    "    result = vec4(0.0);\n"
+    "}";
+
 const char * toMargolusShader =
     "#version " GLSL_VERSION "\n"
     "precision highp float;\n"
     "precision highp int;\n"
     "in vec2 o_texCoords;\n"
-    "layout(location=0) out vec4 output;\n"
+    "layout(location=0) out vec4 result;\n"
     "uniform highp sampler2D cells;\n"
-    "uniform highp sampler2D noise;\n"
     "uniform int width;\n"
     "uniform int type;"
     "uniform float spawnProb;\n"
-    "uniform float seed;\n"
-    "float random(vec2 st){\n"
-    "    return clamp(fract(sin(dot(st.xy, vec2(12.9898,78.233))) * 43758.5453123), 0.000000001, 1.0);\n"
-    "}\n"
+    PHILOX_GLSL
     "int get(ivec2 coords){\n"
     "    ivec2 c = coords % width;\n"
-    "    if (float(c.y) < float(width)*0.5) {"
-    "       float rng = random(vec2(texture(noise, c).r+seed, texture(noise, c).r-seed));\n"
-    "       if (rng < spawnProb/(1.0-float(c.y))) { return 1; }\n"
-    "    }"
+    "    if (c.y == 0 && spawnRandom(c.x) < spawnProb) { return 1; }\n"
     "    return int(texture(cells, vec2(float(c.x)/float(width), float(c.y)/float(width))).r);\n"
     "}"
     "void main(){\n"
@@ -218,7 +314,7 @@ const char * toMargolusShader =
     "    if (2*i+1 >= width-1 && 2*j+1 < width-1){ wall += 16; }\n"
     "    else if (2*i+1 < width-1 && 2*j+1 >= width-1){ wall += 32; }\n"
     "    else if (2*i+1 >= width-1 && 2*j+1 >= width-1){ wall += 48; }\n"
-    "    output = vec4(hash+wall);\n"
+    "    result = vec4(hash+wall);\n"
     "}";
 
 const char * fromMargolusShader =
@@ -226,7 +322,7 @@ const char * fromMargolusShader =
     "precision highp float;\n"
     "precision highp int;\n"
     "in vec2 o_texCoords;\n"
-    "layout(location=0) out vec4 output;\n"
+    "layout(location=0) out vec4 result;\n"
     "uniform highp sampler2D margolus;\n"
     "uniform int width;\n"
     "uniform int type;"
@@ -242,10 +338,10 @@ const char * fromMargolusShader =
     "    vec2 coord = mod((vec2(float(i)-float(type), float(j)-float(type))/2.0)/float(mwidth), 1.0);\n"
     "    vec4 block = map[int(texture(margolus, coord).r)%16];\n"
     "    int bx = abs(i-type) % 2; int by = abs(j-type) % 2;\n"
-    "    if (bx == 0 && by == 0) { output = vec4(block.x); }"
-    "    else if (bx == 1 && by == 0) { output = vec4(block.y); }"
-    "    else if (bx == 0 && by == 1) { output = vec4(block.z); }"
-    "    else if (bx == 1 && by == 1) { output = vec4(block.w); }"
+    "    if (bx == 0 && by == 0) { result = vec4(block.x); }"
+    "    else if (bx == 1 && by == 0) { result = vec4(block.y); }"
+    "    else if (bx == 0 && by == 1) { result = vec4(block.z); }"
+    "    else if (bx == 1 && by == 1) { result = vec4(block.w); }"
     "}";
 
 const char * blockCAComputeShader =
@@ -253,18 +349,14 @@ const char * blockCAComputeShader =
     "precision highp float;\n"
     "precision highp int;\n"
     "in vec2 o_texCoords;\n"
-    "layout(location=0) out vec4 output;\n"
+    "layout(location=0) out vec4 result;\n"
     "uniform highp sampler2D cells;\n"
-    "uniform highp sampler2D noise;\n"
     "uniform highp sampler2D margolus;\n"
     "uniform highp sampler2D obstacles;\n"
     "uniform float reset;\n"
-    "uniform vec2 seed;\n"
     "uniform float p1; uniform float p2; uniform float p31;\n"
     "uniform float p32; uniform float p6; uniform float p7; uniform float p9; uniform float p11;\n"
-    "float random(vec2 st){\n"
-    "    return clamp(fract(sin(dot(st.xy, vec2(12.9898,78.233))) * 43758.5453123), 0.001, 1.0);\n"
-    "}\n"
+    PHILOX_GLSL
     "void main(){\n"
     "    int hash = int(texture(margolus, o_texCoords).r);\n"
     "    bool wallx = false; bool wally = false;"
@@ -272,17 +364,61 @@ const char * blockCAComputeShader =
     "    else if (hash >= 32 && hash < 48) { wally = true; }\n"
     "    else if (hash >= 48) { wallx = true; wally = true; }\n"
     "    hash = hash % 16;\n"
-    "    float d = random(seed+texture(noise, o_texCoords).r*o_texCoords);\n"
-    "    output = vec4(hash);\n"
-    "    if (!wally && hash == 1) { if (!wallx && d<p1) { output = vec4(4); } else { output = vec4(8); } }"
-    "    else if (!wally && hash == 2) { if (d<p2) { output = vec4(8); } else { output = vec4(4); } }"
-    "    else if (!wally && hash == 3) { if (d<p31) { output = vec4(3); } else { if (d<p32){ output = vec4(10); } else { output = vec4(5); } } }"
-    "    else if (hash == 5) { output = vec4(12); }"
-    "    else if (hash == 6) { if (d<p6) { output = vec4(12); } else { output = vec4(6); } }"
-    "    else if (hash == 7) { if (d<p7) { output = vec4(7); } else { output = vec4(14); } }"
-    "    else if (!wallx && hash == 9) { if (d<p9) { output = vec4(12); } else { output = vec4(9); } }"
-    "    else if (hash == 10) { output = vec4(12); }"
-    "    else if (hash == 11) { if (d<p11) { output = vec4(11); } else { output = vec4(13); } }"
+    "    ivec2 b = ivec2(o_texCoords*vec2(textureSize(margolus, 0)));\n"
+    "    float d = blockRandom(b.x, b.y);\n"
+    "    result = vec4(hash);\n"
+    "    if (!wally && hash == 1) { if (!wallx && d<p1) { result = vec4(4); } else { result = vec4(8); } }"
+    "    else if (!wally && hash == 2) { if (d<p2) { result = vec4(8); } else { result = vec4(4); } }"
+    "    else if (!wally && hash == 3) { if (d<p31) { result = vec4(3); } else { if (d<p32){ result = vec4(10); } else { result = vec4(5); } } }"
+    "    else if (hash == 5) { result = vec4(12); }"
+    "    else if (hash == 6) { if (d<p6) { result = vec4(12); } else { result = vec4(6); } }"
+    "    else if (hash == 7) { if (d<p7) { result = vec4(7); } else { result = vec4(14); } }"
+    "    else if (!wallx && hash == 9) { if (d<p9) { result = vec4(12); } else { result = vec4(9); } }"
+    "    else if (hash == 10) { result = vec4(12); }"
+    "    else if (hash == 11) { if (d<p11) { result = vec4(11); } else { result = vec4(13); } }"
+    "}";
+
+/*
+    toMargolus, blockCA and fromMargolus in one pass: each cell finds its
+    block at the current offset, hashes it straight from the cells
+    texture, applies the rule and keeps its own bit of the result.
+*/
+const char * margolusStepShader =
+    "#version " GLSL_VERSION "\n"
+    "precision highp float;\n"
+    "precision highp int;\n"
+    "in vec2 o_texCoords;\n"
+    "layout(location=0) out uvec4 result;\n"
+    "uniform highp usampler2D cells;\n"
+    "uniform int width;\n"
+    "uniform int type;\n"
+    "uniform float spawnProb;\n"
+    "uniform float p1; uniform float p2; uniform float p31;\n"
+    "uniform float p32; uniform float p6; uniform float p7; uniform float p9; uniform float p11;\n"
+    PHILOX_GLSL
+    "int get(ivec2 coords){\n"
+    "    ivec2 c = coords % width;\n"
+    "    if (c.y == 0 && spawnRandom(c.x) < spawnProb) { return 1; }\n"
+    "    return int(texelFetch(cells, c, 0).r);\n"
+    "}\n"
+    "void main(){\n"
+    "    ivec2 s = (ivec2(o_texCoords*float(width))-ivec2(type)+ivec2(width)) % width;\n"
+    "    ivec2 b = s/2; ivec2 q = s % 2;\n"
+    "    ivec2 o = 2*b+ivec2(type);\n"
+    "    int hash = get(o) + get(o+ivec2(1,0))*2 + get(o+ivec2(0,1))*4 + get(o+ivec2(1,1))*8;\n"
+    "    bool wallx = b.x == width/2-1; bool wally = b.y == width/2-1;\n"
+    "    float d = blockRandom(b.x, b.y);\n"
+    "    int next = hash;\n"
+    "    if (!wally && hash == 1) { if (!wallx && d<p1) { next = 4; } else { next = 8; } }"
+    "    else if (!wally && hash == 2) { if (d<p2) { next = 8; } else { next = 4; } }"
+    "    else if (!wally && hash == 3) { if (d<p31) { next = 3; } else { if (d<p32){ next = 10; } else { next = 5; } } }"
+    "    else if (hash == 5) { next = 12; }"
+    "    else if (hash == 6) { if (d<p6) { next = 12; } else { next = 6; } }"
+    "    else if (hash == 7) { if (d<p7) { next = 7; } else { next = 14; } }"
+    "    else if (!wallx && hash == 9) { if (d<p9) { next = 12; } else { next = 9; } }"
+    "    else if (hash == 10) { next = 12; }"
+    "    else if (hash == 11) { if (d<p11) { next = 11; } else { next = 13; } }\n"
+    "    result = uvec4(uint((next >> (q.x+2*q.y)) & 1));\n"
     "}";
 
 float clamp(float x, float low, float high)
@@ -301,19 +437,26 @@ glm::vec3 cmap(float t)
     return glm::vec3( poly(t,0.91, 3.74, -32.33, 57.57, -28.99), poly(t,0.2, 5.6, -18.89, 25.55, -12.25), poly(t,0.22, -4.89, 22.31, -23.58, 5.97) );
 }
 
-void placeOrRemove(std::vector<float> & into, int i, int j, int brush, int l, float value)
+// texel by texel over the inclusive rectangle of cells, wrapping at the
+// l x l grid, so the next sync uploads just the brush's rectangle
+void paint(glCompute & into, std::string attribute, int x0, int y0, int x1, int y1, int l, float value)
 {
-    for (int n = -brush; n <= brush; n++)
+    for (int x = x0; x <= x1; x++)
     {
-        for (int m = -brush; m <= brush; m++)
+        for (int y = y0; y <= y1; y++)
         {
-            int ix = (n+i) % l;
-            int iy = (m+j) % l;
+            int ix = x % l;
+            int iy = y % l;
             if (ix < 0) { ix += l; }
             if (iy < 0) { iy += l; }
-            into[iy*l+ix] = value;
+            into.set(attribute, value, iy*l+ix);
         }
     }
 }
 
+void placeOrRemove(glCompute & into, std::string attribute, int i, int j, int brush, int l, float value)
+{
+    paint(into, attribute, i-brush, j-brush, i+brush, j+brush, l, value);
+}
+
 #endif /* MAIN_H */
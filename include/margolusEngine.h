@@ -0,0 +1,221 @@
+#ifndef MARGOLUSENGINE_H
+#define MARGOLUSENGINE_H
+
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <stdexcept>
+#include <memory>
+
+#include <jThread/jThread.h>
+#include <bitGrid.h>
+#include <blockKernel.h>
+#include <philox.h>
+
+class Snapshot;
+
+/*
+
+    CPU implementation of the Margolus block automaton run by the
+    toMargolusShader, blockCAComputeShader and fromMargolusShader passes.
+
+    Cells are stored one bit each in a BitGrid, with y = 0 the top row
+    (texture row 0) and particles falling towards increasing y. Blocks of
+    a phase never overlap so the grid is updated in place, 32 blocks per
+    pair of row words by a BlockKernel (width must be a multiple of 64).
+    The fastest kernel the cpu supports is used unless set otherwise.
+
+    Each block draws one random byte d and compares d/256 against the
+    probabilities, which are therefore quantised to steps of 1/256. The
+    bytes come from Philox keyed by the seed and counted by (step, block
+    x, block y), the same numbers the shaders draw, so results do not
+    depend on the thread count or on which tiles are active.
+
+    With threads > 1 the block rows are split into one horizontal band
+    per thread, stepped in parallel on a jThread::ThreadPool and joined
+    once per phase.
+
+    The grid is divided into TILE x TILE cell tiles, and only active
+    tiles are stepped. A tile whose blocks changed wakes itself and its 8
+    neighbours (periodically) for the next two steps, one of each phase,
+    and a tile with a block that could have changed but did not stays
+    awake. So a tile sleeps only once no block in it can change in either
+    phase, which holds until an edit or a neighbour wakes it again. Random
+    numbers are only drawn for active tiles.
+
+*/
+
+class MargolusEngine
+{
+
+public:
+
+    static constexpr uint64_t TILE = 64;
+
+    struct Parameters
+    {
+        Parameters()
+        : p1(0.1f), p2(0.1f), p31(0.1f), p32(0.1f),
+          p6(0.9f), p7(0.1f), p9(0.9f), p11(0.1f),
+          spawnProb(0.0f)
+        {}
+
+        float p1, p2, p31, p32, p6, p7, p9, p11;
+        // per cell, per step probability of spawning in the top row
+        float spawnProb;
+    };
+
+    MargolusEngine
+    (
+        uint64_t width,
+        uint64_t height,
+        Parameters parameters = Parameters(),
+        uint64_t seed = std::random_device()()
+    );
+
+    ~MargolusEngine();
+
+    void step();
+
+    uint8_t get(uint64_t i, uint64_t j) const { return cells.get(i, j); }
+
+    void set(uint64_t i, uint64_t j, uint8_t value)
+    {
+        if (cells.get(i, j) == (value > 0)) { return; }
+        if (snapshot) { preserve(i/TILE, j/TILE); }
+        cells.set(i, j, value > 0);
+        modified[(j/TILE)*tilesX+i/TILE] = steps;
+        lastModified = steps;
+        wake(i/TILE, j/TILE);
+    }
+
+    // square brush of half width brush, wrapping like placeOrRemove
+    void place(int i, int j, int brush, uint8_t value);
+
+    void clear()
+    {
+        detachSnapshot();
+        cells.clear();
+        wakeAll();
+        std::fill(modified.begin(), modified.end(), steps);
+        lastModified = steps;
+    }
+
+    // carry on from a saved state (a Checkpoint) of the same size
+    void restore(const BitGrid & state, int type, uint64_t steps);
+
+    /*
+        The cells, step and parameters as of now, without copying the
+        grid: tiles are copied into the Snapshot only as stepping or
+        editing is about to change them, so it can be saved on another
+        thread while stepping carries on. Taking another snapshot first
+        detaches the previous one.
+    */
+    std::shared_ptr<Snapshot> takeSnapshot();
+
+    const BitGrid & getCells() const { return cells; }
+
+    uint64_t getWidth() const { return width; }
+    uint64_t getHeight() const { return height; }
+    int getType() const { return type; }
+    uint64_t getSteps() const { return steps; }
+    uint64_t getSeed() const { return seed; }
+
+    const Parameters & getParameters() const { return parameters; }
+    void setParameters(Parameters p) { parameters = p; updateTables(); wakeAll(); }
+
+    KernelType getKernel() const { return kernelType; }
+    void setKernel(KernelType type) { kernel = ::getKernel(type); kernelType = type; }
+
+    unsigned getThreads() const { return bands.size(); }
+    void setThreads(unsigned n);
+
+    // tiles to be stepped next
+    uint64_t getActiveTiles() const;
+
+    // per tile, row by row, the step count when its cells last changed
+    // (or may have), so a tile with an older count is as it was then
+    const std::vector<uint64_t> & getModified() const { return modified; }
+    // the latest of them
+    uint64_t getLastModified() const { return lastModified; }
+
+    // when off every tile is stepped every step
+    bool getTileTracking() const { return tracking; }
+    void setTileTracking(bool on) { tracking = on; wakeAll(); }
+
+    /*
+        The blockCAComputeShader transition table: hash is the 4 bit
+        block state (1 top left, 2 top right, 4 bottom left, 8 bottom
+        right), wallx/wally flag the last block column/row and d is the
+        block's uniform random number.
+    */
+    static uint8_t rule
+    (
+        uint8_t hash,
+        bool wallx,
+        bool wally,
+        float d,
+        const Parameters & p
+    );
+
+private:
+
+    uint64_t width, height;
+    Parameters parameters;
+    int type;
+    uint64_t steps;
+
+    BitGrid cells;
+
+    uint64_t seed;
+
+    KernelType kernelType;
+    BlockKernel kernel;
+
+    // rule tables and their mobile hashes indexed by [wally][wallx]
+    BlockTables tables[2][2];
+    uint16_t mobile[2][2];
+
+    enum TileFlag : uint8_t { CHANGED = 1, MOBILE = 2 };
+
+    bool tracking;
+    uint64_t tilesX, tilesY;
+    // steps left to run each tile for, and what happened in it this step
+    std::vector<uint8_t> ttl, flags;
+    std::vector<uint64_t> modified;
+    uint64_t lastModified;
+
+    // a contiguous range of block rows, whole tile rows so no two bands
+    // share a tile, and its scratch space
+    struct Band
+    {
+        uint64_t begin, end;
+        std::vector<uint8_t> random;
+        std::vector<uint64_t> top, bottom, oldTop, oldBottom;
+    };
+
+    std::vector<Band> bands;
+    std::unique_ptr<jThread::ThreadPool> pool;
+
+    // held until all its tiles are preserved
+    std::shared_ptr<Snapshot> snapshot;
+
+    void preserve(uint64_t tx, uint64_t ty);
+    // tiles a band's next step can write
+    void preserveBand(const Band & band);
+    void detachSnapshot();
+
+    void updateTables();
+
+    void spawn();
+
+    void wake(uint64_t tx, uint64_t ty);
+    void wakeAll() { std::fill(ttl.begin(), ttl.end(), 2); }
+    void updateTiles();
+
+    void stepBand(Band & band);
+    void stepBlockRow(uint64_t bj, Band & band);
+    void stepRun(uint64_t bj, uint64_t k0, uint64_t k1, Band & band);
+};
+
+#endif /* MARGOLUSENGINE_H */
@@ -0,0 +1,234 @@
+#ifndef OFFSCREENDISPLAY_H
+#define OFFSCREENDISPLAY_H
+
+#include <jGL/OpenGL/gl.h>
+#include <jGL/Display/display.h>
+#include <jGL/Display/event.h>
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef HAVE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+/*
+
+    An OpenGL 3.3 core context with no window, for machines without an X
+    server. Tried in order:
+
+        EGL on Mesa's surfaceless platform, a pbuffer surface
+        EGL on the default display, a pbuffer surface
+        OSMesa, rendering into host memory
+
+    The pbuffer (or OSMesa buffer) is the default framebuffer, so drawing
+    to framebuffer 0 works as it does in a window. There is no input:
+    keyHasEvent is always false and the mouse sits at the origin. The
+    display stays open until close().
+
+*/
+
+class OffscreenDisplay : public jGL::Display
+{
+
+public:
+
+    OffscreenDisplay(glm::ivec2 res)
+    : jGL::Display(res), open(false)
+    {
+#ifdef HAVE_EGL
+        if (openEGL(true) || openEGL(false))
+        {
+            open = true;
+            return;
+        }
+#endif
+#ifdef HAVE_OSMESA
+        if (openOSMesa())
+        {
+            open = true;
+            return;
+        }
+#endif
+        throw std::runtime_error("Could not create an offscreen OpenGL context");
+    }
+
+    ~OffscreenDisplay()
+    {
+        close();
+    }
+
+    bool isOpen() { return open; }
+
+    void close()
+    {
+        if (!open) { return; }
+#ifdef HAVE_EGL
+        if (eglDisplay != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroySurface(eglDisplay, eglSurface);
+            eglDestroyContext(eglDisplay, eglContext);
+            eglTerminate(eglDisplay);
+            eglDisplay = EGL_NO_DISPLAY;
+        }
+#endif
+#ifdef HAVE_OSMESA
+        if (osmesaContext != NULL)
+        {
+            OSMesaDestroyContext(osmesaContext);
+            osmesaContext = NULL;
+        }
+#endif
+        open = false;
+    }
+
+    // which of the backends above is in use
+    std::string getBackend() const { return backend; }
+
+    void loop()
+    {
+#ifdef HAVE_EGL
+        if (eglDisplay != EGL_NO_DISPLAY) { eglSwapBuffers(eglDisplay, eglSurface); }
+#endif
+#ifdef HAVE_OSMESA
+        if (osmesaContext != NULL) { glFinish(); }
+#endif
+        throttle();
+    }
+
+    void setVsync(bool on)
+    {
+#ifdef HAVE_EGL
+        if (eglDisplay != EGL_NO_DISPLAY) { eglSwapInterval(eglDisplay, on ? 1 : 0); }
+#endif
+    }
+
+    bool keyHasEvent(int key, jGL::EventType action) { return false; }
+
+    void mousePosition(double & x, double & y) { x = 0.0; y = 0.0; }
+
+private:
+
+    bool open;
+    std::string backend;
+
+#ifdef HAVE_EGL
+    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+    EGLSurface eglSurface = EGL_NO_SURFACE;
+    EGLContext eglContext = EGL_NO_CONTEXT;
+
+    bool openEGL(bool surfaceless)
+    {
+        EGLDisplay d = EGL_NO_DISPLAY;
+        if (surfaceless)
+        {
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+            auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>
+            (
+                eglGetProcAddress("eglGetPlatformDisplayEXT")
+            );
+            if (getPlatformDisplay != NULL)
+            {
+                d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            }
+#endif
+        }
+        else
+        {
+            d = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+        if (d == EGL_NO_DISPLAY) { return false; }
+
+        EGLint major, minor;
+        if (!eglInitialize(d, &major, &minor)) { return false; }
+        if (!eglBindAPI(EGL_OPENGL_API)) { eglTerminate(d); return false; }
+
+        const EGLint configAttributes[] =
+        {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_ALPHA_SIZE, 8,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(d, configAttributes, &config, 1, &configs) || configs == 0)
+        {
+            eglTerminate(d);
+            return false;
+        }
+
+        const EGLint surfaceAttributes[] =
+        {
+            EGL_WIDTH, resolution.x,
+            EGL_HEIGHT, resolution.y,
+            EGL_NONE
+        };
+        EGLSurface s = eglCreatePbufferSurface(d, config, surfaceAttributes);
+        if (s == EGL_NO_SURFACE) { eglTerminate(d); return false; }
+
+        const EGLint contextAttributes[] =
+        {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        EGLContext c = eglCreateContext(d, config, EGL_NO_CONTEXT, contextAttributes);
+        if (c == EGL_NO_CONTEXT || !eglMakeCurrent(d, s, s, c))
+        {
+            if (c != EGL_NO_CONTEXT) { eglDestroyContext(d, c); }
+            eglDestroySurface(d, s);
+            eglTerminate(d);
+            return false;
+        }
+
+        eglDisplay = d;
+        eglSurface = s;
+        eglContext = c;
+        backend = surfaceless ? "EGL surfaceless" : "EGL";
+        return true;
+    }
+#endif
+
+#ifdef HAVE_OSMESA
+    OSMesaContext osmesaContext = NULL;
+    std::vector<uint8_t> osmesaBuffer;
+
+    bool openOSMesa()
+    {
+        const int attributes[] =
+        {
+            OSMESA_FORMAT, OSMESA_RGBA,
+            OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+            OSMESA_CONTEXT_MAJOR_VERSION, 3,
+            OSMESA_CONTEXT_MINOR_VERSION, 3,
+            0
+        };
+        osmesaContext = OSMesaCreateContextAttribs(attributes, NULL);
+        if (osmesaContext == NULL) { return false; }
+        osmesaBuffer.resize(resolution.x*resolution.y*4);
+        if (!OSMesaMakeCurrent(osmesaContext, osmesaBuffer.data(), GL_UNSIGNED_BYTE, resolution.x, resolution.y))
+        {
+            OSMesaDestroyContext(osmesaContext);
+            osmesaContext = NULL;
+            return false;
+        }
+        backend = "OSMesa";
+        return true;
+    }
+#endif
+
+};
+
+#endif /* OFFSCREENDISPLAY_H */
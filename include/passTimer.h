@@ -0,0 +1,178 @@
+#ifndef PASSTIMER_H
+#define PASSTIMER_H
+
+#include <jGL/OpenGL/gl.h>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+
+/*
+
+    Per pass timing: wall clock on the CPU and GL_TIME_ELAPSED on the GPU.
+
+    Each pass keeps two sets of queries. Those issued in one frame are read
+    at the end of the next, when they have almost always finished, and a
+    query still pending then is dropped rather than waited on, so timing
+    never stalls the pipeline. GL_TIME_ELAPSED queries cannot nest, so a
+    scope opened inside another timed on the GPU is timed on the CPU only.
+
+    Times are averaged per frame since the last report(), and a pass's GPU
+    times may also be kept one by one with keepSamples().
+
+*/
+
+class PassTimer
+{
+
+public:
+
+    class Scope
+    {
+    public:
+
+        // timer may be null, timing nothing
+        Scope(PassTimer * timer, std::string name, bool gpu = true)
+        : timer(timer), name(name), gpu(false)
+        {
+            if (timer != nullptr) { this->gpu = timer->begin(name, gpu); }
+        }
+
+        ~Scope()
+        {
+            if (timer != nullptr) { timer->end(name, gpu); }
+        }
+
+    private:
+
+        PassTimer * timer;
+        std::string name;
+        bool gpu;
+    };
+
+    ~PassTimer()
+    {
+        for (auto & pass : passes)
+        {
+            for (unsigned b = 0; b < 2; b++)
+            {
+                std::vector<GLuint> & q = pass.second.queries[b];
+                if (!q.empty()) { glDeleteQueries(q.size(), q.data()); }
+            }
+        }
+    }
+
+    // returns whether a GPU query was started
+    bool begin(const std::string & name, bool gpu)
+    {
+        if (passes.find(name) == passes.end()) { order.push_back(name); }
+        Pass & pass = passes[name];
+        pass.start = std::chrono::steady_clock::now();
+        if (!gpu || gpuActive) { return false; }
+
+        std::vector<GLuint> & q = pass.queries[current];
+        if (pass.used[current] == q.size())
+        {
+            GLuint query;
+            glGenQueries(1, &query);
+            q.push_back(query);
+        }
+        glBeginQuery(GL_TIME_ELAPSED, q[pass.used[current]]);
+        pass.used[current]++;
+        gpuActive = true;
+        return true;
+    }
+
+    void end(const std::string & name, bool gpu)
+    {
+        Pass & pass = passes[name];
+        pass.cpu += std::chrono::duration<double>(std::chrono::steady_clock::now()-pass.start).count();
+        pass.calls++;
+        if (gpu)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            gpuActive = false;
+        }
+    }
+
+    // call once a frame, outside any scope
+    void frame()
+    {
+        const unsigned last = 1-current;
+        for (auto & p : passes)
+        {
+            Pass & pass = p.second;
+            for (size_t i = 0; i < pass.used[last]; i++)
+            {
+                GLint available = 0;
+                glGetQueryObjectiv(pass.queries[last][i], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) { continue; }
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(pass.queries[last][i], GL_QUERY_RESULT, &ns);
+                pass.gpu += ns*1e-9;
+                pass.gpuSamples++;
+                if (pass.samples != nullptr) { pass.samples->push_back(ns*1e-9); }
+            }
+            pass.used[last] = 0;
+        }
+        current = last;
+        frames++;
+    }
+
+    // appends each GPU time of the pass read from now on, in seconds
+    void keepSamples(const std::string & name, std::vector<double> * samples)
+    {
+        if (passes.find(name) == passes.end()) { order.push_back(name); }
+        passes[name].samples = samples;
+    }
+
+    // mean ms per frame of each pass since the last report, then reset
+    std::string report()
+    {
+        std::stringstream s;
+        s << std::fixed << std::setprecision(3);
+        for (const std::string & name : order)
+        {
+            Pass & pass = passes[name];
+            s << name << ": cpu " << (frames > 0 ? pass.cpu*1e3/frames : 0.0) << " ms";
+            if (pass.gpuSamples > 0)
+            {
+                // scaled up for queries dropped while pending
+                s << ", gpu " << pass.gpu*1e3/pass.gpuSamples*pass.calls/std::max(frames, uint64_t(1)) << " ms";
+            }
+            s << "\n";
+            pass.cpu = 0.0;
+            pass.gpu = 0.0;
+            pass.calls = 0;
+            pass.gpuSamples = 0;
+        }
+        frames = 0;
+        return s.str();
+    }
+
+private:
+
+    struct Pass
+    {
+        double cpu = 0.0;
+        double gpu = 0.0;
+        uint64_t calls = 0;
+        uint64_t gpuSamples = 0;
+        std::chrono::steady_clock::time_point start;
+        std::vector<GLuint> queries[2];
+        size_t used[2] = {0, 0};
+        std::vector<double> * samples = nullptr;
+    };
+
+    std::map<std::string, Pass> passes;
+    // passes in the order first seen
+    std::vector<std::string> order;
+    unsigned current = 0;
+    uint64_t frames = 0;
+    bool gpuActive = false;
+};
+
+#endif /* PASSTIMER_H */
@@ -0,0 +1,127 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+/*
+
+    Hardware counters for this process through Linux perf_event_open:
+    cycles, instructions, last level cache misses and branch misses.
+
+    Counters inherit into threads created after construction, so make
+    this before any thread pool whose work should be counted. A counter
+    the kernel refuses (no PMU in a VM, perf_event_paranoid, not Linux)
+    is simply unavailable, never an error.
+
+*/
+
+class PerfCounters
+{
+
+public:
+
+    struct Counter
+    {
+        std::string name;
+        bool available;
+        uint64_t value;
+    };
+
+    PerfCounters()
+    {
+#ifdef __linux__
+        open("cycles", PERF_COUNT_HW_CPU_CYCLES);
+        open("instructions", PERF_COUNT_HW_INSTRUCTIONS);
+        open("LLC misses", PERF_COUNT_HW_CACHE_MISSES);
+        open("branch misses", PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd >= 0) { close(fd); }
+        }
+#endif
+    }
+
+    bool anyAvailable() const
+    {
+        for (const Counter & c : counters)
+        {
+            if (c.available) { return true; }
+        }
+        return false;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd < 0) { continue; }
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // counts since start()
+    const std::vector<Counter> & stop()
+    {
+#ifdef __linux__
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (fds[i] < 0) { continue; }
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value = 0;
+            if (read(fds[i], &value, sizeof(value)) == sizeof(value))
+            {
+                counters[i].value = value;
+            }
+            else
+            {
+                counters[i].available = false;
+            }
+        }
+#endif
+        return counters;
+    }
+
+private:
+
+    std::vector<Counter> counters;
+    std::vector<int> fds;
+
+#ifdef __linux__
+    void open(std::string name, uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        fds.push_back(fd);
+        counters.push_back({name, fd >= 0, 0});
+    }
+#endif
+};
+
+#endif /* PERFCOUNTERS_H */
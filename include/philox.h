@@ -0,0 +1,99 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+/*
+
+    Philox4x32-10 counter-based generator, Salmon et al. 2011, "Parallel
+    random numbers: as easy as 1, 2, 3". Every random number is a pure
+    function of (seed, step, block x, block y), so any engine, thread
+    count or set of active tiles draws the same number for a block.
+
+    The C++ and GLSL versions below must stay in step: the GLSL one has
+    no 64 bit multiply (GLSL 330 lacks umulExtended) so builds the high
+    word from 16 bit halves.
+
+    Counters:
+        block bytes  (bx/16, by, step low, step high), byte bx%16
+        spawn words  (x/4, 0xFFFFFFFF, step low, step high), word x%4
+
+*/
+
+const uint32_t PHILOX_M0 = 0xD2511F53u;
+const uint32_t PHILOX_M1 = 0xCD9E8D57u;
+const uint32_t PHILOX_W0 = 0x9E3779B9u;
+const uint32_t PHILOX_W1 = 0xBB67AE85u;
+const uint32_t PHILOX_SPAWN_ROW = 0xFFFFFFFFu;
+
+inline void philox4x32(const uint32_t counter[4], uint64_t seed, uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = uint32_t(seed), k1 = uint32_t(seed >> 32);
+    for (int r = 0; r < 10; r++)
+    {
+        const uint64_t p0 = uint64_t(PHILOX_M0)*c0;
+        const uint64_t p1 = uint64_t(PHILOX_M1)*c2;
+        c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+        c1 = uint32_t(p1);
+        c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+        c3 = uint32_t(p0);
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// random bytes of the 16 blocks bx0 = 16*x, ..., 16*x+15 of block row by
+inline void blockRandom16(uint64_t seed, uint64_t step, uint32_t x, uint32_t by, uint32_t out[4])
+{
+    const uint32_t counter[4] = {x, by, uint32_t(step), uint32_t(step >> 32)};
+    philox4x32(counter, seed, out);
+}
+
+// uniform in [0, 1) with 24 bits, exact in float on both sides
+inline float spawnRandom(uint64_t seed, uint64_t step, uint32_t x)
+{
+    const uint32_t counter[4] = {x/4, PHILOX_SPAWN_ROW, uint32_t(step), uint32_t(step >> 32)};
+    uint32_t out[4];
+    philox4x32(counter, seed, out);
+    return float(out[x % 4] >> 8)*(1.0f/16777216.0f);
+}
+
+/*
+    GLSL versions, spliced into shaders. The seed and step are passed as
+    int uniforms (seedLo, seedHi, stepLo, stepHi), whose bit patterns
+    uint() preserves. blockRandom returns (d+0.5)/256 for the block's
+    byte d, so comparing it against p agrees with the CPU's d < round(256 p).
+*/
+#define PHILOX_GLSL \
+    "uniform int seedLo; uniform int seedHi; uniform int stepLo; uniform int stepHi;\n" \
+    "uvec2 mulhilo(uint a, uint b){\n" \
+    "    uint ll = (a & 0xFFFFu)*(b & 0xFFFFu); uint lh = (a & 0xFFFFu)*(b >> 16u);\n" \
+    "    uint hl = (a >> 16u)*(b & 0xFFFFu); uint hh = (a >> 16u)*(b >> 16u);\n" \
+    "    uint mid = (ll >> 16u) + (lh & 0xFFFFu) + (hl & 0xFFFFu);\n" \
+    "    return uvec2(hh + (lh >> 16u) + (hl >> 16u) + (mid >> 16u), a*b);\n" \
+    "}\n" \
+    "uvec4 philox4x32(uvec4 c){\n" \
+    "    uvec2 k = uvec2(uint(seedLo), uint(seedHi));\n" \
+    "    for (int r = 0; r < 10; r++){\n" \
+    "        uvec2 p0 = mulhilo(0xD2511F53u, c.x); uvec2 p1 = mulhilo(0xCD9E8D57u, c.z);\n" \
+    "        c = uvec4(p1.x ^ c.y ^ k.x, p1.y, p0.x ^ c.w ^ k.y, p0.y);\n" \
+    "        k += uvec2(0x9E3779B9u, 0xBB67AE85u);\n" \
+    "    }\n" \
+    "    return c;\n" \
+    "}\n" \
+    "float blockRandom(int bx, int by){\n" \
+    "    uvec4 r = philox4x32(uvec4(uint(bx) >> 4u, uint(by), uint(stepLo), uint(stepHi)));\n" \
+    "    uint j = uint(bx) & 15u;\n" \
+    "    uint w = j < 4u ? r.x : (j < 8u ? r.y : (j < 12u ? r.z : r.w));\n" \
+    "    return (float((w >> (8u*(j & 3u))) & 0xFFu)+0.5)/256.0;\n" \
+    "}\n" \
+    "float spawnRandom(int x){\n" \
+    "    uvec4 r = philox4x32(uvec4(uint(x) >> 2u, 0xFFFFFFFFu, uint(stepLo), uint(stepHi)));\n" \
+    "    uint j = uint(x) & 3u;\n" \
+    "    uint w = j == 0u ? r.x : (j == 1u ? r.y : (j == 2u ? r.z : r.w));\n" \
+    "    return float(w >> 8u)/16777216.0;\n" \
+    "}\n"
+
+#endif /* PHILOX_H */
@@ -0,0 +1,203 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include <bitGrid.h>
+#include <margolusEngine.h>
+
+/*
+
+    A compact recording of a run's cells, step by step.
+
+        "SNOWRECD"      magic
+        uint32          version
+        uint64          width, height
+        uint32          tile size (MargolusEngine::TILE)
+        uint64          seed
+
+    then records of
+
+        uint8           Kind
+        uint64          step
+        uint32          payload bytes
+        payload
+
+        KEY             every tile, row by row, coded as in a Checkpoint
+        DELTA           varint tiles, then per tile a varint index step
+                        from the previous tile and the tile's XOR with
+                        the last frame, run length coded (no zlib) or
+                        raw when busier
+        END             the last step recorded, no payload
+        INDEX           uint64 last step, varint keys, then per key
+                        uint64 step and file offset
+
+    and finally uint64 offset of the INDEX record then "SNOWRIDX". All
+    little endian. A frame's cells are the last KEY before it with every
+    DELTA up to it applied. Frames that changed nothing are not written,
+    the cells at any step being those of the last frame at or before it.
+
+    The stepping thread only copies the tiles MargolusEngine::getModified
+    says changed since the last frame taken, so a frame costs in
+    proportion to the moving sand and a still world almost nothing. A
+    writer thread XORs them against the last frame, codes them and does
+    all the file output. At most capacity frames wait for it; a frame
+    offered while they are all waiting is skipped, its changes carried
+    into the next frame taken, so the engine never waits on the writer.
+
+*/
+
+class RecordingWriter
+{
+
+public:
+
+    enum class Kind : uint8_t { KEY, DELTA, END, INDEX };
+
+    static const uint64_t KEY_DELTA_GRIDS = 4;
+
+    /*
+        A keyframe every keyFrames frames written, or sooner once the
+        deltas since the last come to KEY_DELTA_GRIDS grids' worth of
+        bytes, so a seek never decodes much more than that from its
+        keyframe.
+    */
+    RecordingWriter
+    (
+        std::string path,
+        const MargolusEngine & engine,
+        uint64_t keyFrames = 1024,
+        size_t capacity = 8
+    );
+
+    // closes, writing the END, INDEX and trailer
+    ~RecordingWriter();
+
+    /*
+        The engine's cells at its current step, after the last frame's;
+        whether the frame was taken. With wait it waits for room instead
+        of being skipped, for a run's last frame.
+    */
+    bool frame(const MargolusEngine & engine, bool wait = false);
+
+    void close();
+
+    uint64_t getFrames() const { return frames; }
+    uint64_t getSkipped() const { return skipped; }
+    // frames actually written, those that changed something
+    uint64_t getWritten();
+    uint64_t getKeys();
+
+private:
+
+    struct Record
+    {
+        Kind kind;
+        uint64_t step;
+        // tiles that may have changed since the last frame, and their
+        // words, TILE per tile
+        std::vector<uint64_t> tiles;
+        std::vector<uint64_t> words;
+    };
+
+    std::ofstream file;
+    uint64_t width, height, tilesX, tilesY;
+    size_t capacity;
+
+    // the stepping thread's
+    uint64_t frames, skipped, lastStep;
+    bool closed;
+
+    // the writer thread's: cells as of the last frame written, and
+    // deltas and their bytes since the last keyframe
+    BitGrid previous;
+    uint64_t keyFrames, sinceKey, deltaBytes;
+    std::vector<uint8_t> coded;
+    uint64_t offset;
+
+    std::mutex lock;
+    std::condition_variable condition;
+    std::deque<Record> records;
+    // taken records' buffers, handed back for reuse
+    std::vector<Record> spare;
+    std::vector<std::pair<uint64_t, uint64_t>> keys;
+    uint64_t written;
+    bool terminate;
+    std::thread writer;
+
+    void write(Kind kind, uint64_t step, const std::vector<uint8_t> & payload);
+    void writeFrame(const Record & record);
+    void writeLoop();
+};
+
+class RecordingReader
+{
+
+public:
+
+    RecordingReader(std::string path);
+
+    uint64_t getWidth() const { return width; }
+    uint64_t getHeight() const { return height; }
+    uint64_t getSeed() const { return seed; }
+
+    // steps of the first frame and of the END, if the recording has one
+    uint64_t firstStep() const { return keys.empty() ? 0 : keys.front().first; }
+    uint64_t lastStep() const { return end; }
+
+    /*
+        To the cells at step, those of the last frame at or before it;
+        false if step is before the first frame. Decodes from the nearest
+        keyframe, or carries on from the current frame when that is
+        nearer.
+    */
+    bool seek(uint64_t step);
+
+    // to the next frame, false at the end
+    bool next();
+
+    // step of the current frame
+    uint64_t getStep() const { return step; }
+    const BitGrid & getCells() const { return cells; }
+
+    uint64_t getKeys() const { return keys.size(); }
+
+private:
+
+    std::ifstream file;
+    uint64_t width, height, tilesX, tilesY, seed;
+    uint64_t dataStart;
+    // step and record offset of each keyframe
+    std::vector<std::pair<uint64_t, uint64_t>> keys;
+    uint64_t end;
+
+    BitGrid cells;
+    uint64_t step;
+    bool positioned;
+    // offset of the record after the current frame
+    uint64_t nextRecord;
+
+    struct Header
+    {
+        RecordingWriter::Kind kind;
+        uint64_t step;
+        uint32_t bytes;
+    };
+
+    uint64_t fileBytes;
+
+    bool readHeader(uint64_t at, Header & header);
+    // builds the index by walking the records, for unclosed recordings
+    void scan();
+    void apply(const Header & header, uint64_t at);
+};
+
+#endif /* RECORDING_H */
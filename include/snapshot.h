@@ -0,0 +1,121 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+
+#include <bitGrid.h>
+#include <margolusEngine.h>
+
+/*
+
+    A copy on write view of a MargolusEngine's cells at one step, taken
+    by MargolusEngine::takeSnapshot without copying the grid.
+
+    Each TILE x TILE tile starts out shared with the live grid. Before the
+    engine writes a shared tile it preserves it, copying the tile into the
+    snapshot's own page, and a reader preserves a tile the same way before
+    reading it. Whoever moves a tile from LIVE to BUSY copies it, anyone
+    else meeting it BUSY waits the few hundred nanoseconds that takes, so
+    each tile is copied exactly once and a reader on another thread never
+    sees a tile the engine is writing.
+
+    Once every tile is preserved the snapshot no longer refers to the
+    engine and the engine lets go of it. An engine preserves every tile
+    before it is destroyed or restored, so a snapshot may outlive it.
+
+*/
+
+class Snapshot
+{
+
+public:
+
+    Snapshot(const MargolusEngine & engine)
+    : width(engine.getWidth()), height(engine.getHeight()), type(engine.getType()),
+      seed(engine.getSeed()), steps(engine.getSteps()), parameters(engine.getParameters()),
+      live(&engine.getCells()),
+      tilesX(width/MargolusEngine::TILE),
+      tilesY((height+MargolusEngine::TILE-1)/MargolusEngine::TILE),
+      states(new std::atomic<uint8_t>[tilesX*tilesY]),
+      // pages are left uninitialised, only preserved tiles touch them
+      pages(new uint64_t[tilesX*tilesY*MargolusEngine::TILE]),
+      remaining(tilesX*tilesY)
+    {
+        for (uint64_t t = 0; t < tilesX*tilesY; t++) { states[t].store(LIVE, std::memory_order_relaxed); }
+    }
+
+    uint64_t getWidth() const { return width; }
+    uint64_t getHeight() const { return height; }
+    int getType() const { return type; }
+    uint64_t getSeed() const { return seed; }
+    uint64_t getSteps() const { return steps; }
+    const MargolusEngine::Parameters & getParameters() const { return parameters; }
+
+    // copies the TILE words of tile (tx, ty), one per row, into words
+    void tile(uint64_t tx, uint64_t ty, uint64_t * words)
+    {
+        preserve(tx, ty);
+        const uint64_t * page = &pages[(ty*tilesX+tx)*MargolusEngine::TILE];
+        std::memcpy(words, page, rows(ty)*sizeof(uint64_t));
+    }
+
+    // detach tile (tx, ty) from the live grid, call before writing it
+    void preserve(uint64_t tx, uint64_t ty)
+    {
+        std::atomic<uint8_t> & state = states[ty*tilesX+tx];
+        while (true)
+        {
+            uint8_t s = state.load(std::memory_order_acquire);
+            if (s == COPIED) { return; }
+            if (s == LIVE && state.compare_exchange_strong(s, BUSY, std::memory_order_acquire))
+            {
+                uint64_t * page = &pages[(ty*tilesX+tx)*MargolusEngine::TILE];
+                for (uint64_t r = 0; r < rows(ty); r++)
+                {
+                    page[r] = live->row(ty*MargolusEngine::TILE+r)[tx];
+                }
+                state.store(COPIED, std::memory_order_release);
+                remaining.fetch_sub(1, std::memory_order_release);
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void preserveAll()
+    {
+        for (uint64_t ty = 0; ty < tilesY; ty++)
+        {
+            for (uint64_t tx = 0; tx < tilesX; tx++) { preserve(tx, ty); }
+        }
+    }
+
+    // whether every tile has been copied out of the live grid
+    bool detached() const { return remaining.load(std::memory_order_acquire) == 0; }
+
+private:
+
+    enum State : uint8_t { LIVE, BUSY, COPIED };
+
+    uint64_t width, height;
+    int type;
+    uint64_t seed, steps;
+    MargolusEngine::Parameters parameters;
+
+    const BitGrid * live;
+    uint64_t tilesX, tilesY;
+    std::unique_ptr<std::atomic<uint8_t>[]> states;
+    std::unique_ptr<uint64_t[]> pages;
+    std::atomic<uint64_t> remaining;
+
+    uint64_t rows(uint64_t ty) const
+    {
+        return std::min(MargolusEngine::TILE, height-ty*MargolusEngine::TILE);
+    }
+};
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,219 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+/*
+
+    Timeline tracing to the Chrome trace event format, viewable in
+    chrome://tracing or Perfetto.
+
+    Each thread records complete ("X") events into its own buffer, a list
+    of fixed size chunks that only it appends to. An event is published by
+    a release store of its chunk's count, so write() can read every buffer
+    while threads are still recording, with no locks on the recording
+    path. A mutex is only taken the first time a thread records, to
+    register its buffer; buffers outlive their threads so pool workers'
+    events survive the pool.
+
+    Event names are not copied and must outlive the trace: string literals
+    or strings owned by long lived objects.
+
+        Trace::enable();
+        {
+            Trace::Scope scope("step");
+            ...
+        }
+        Trace::write("trace.json");
+
+*/
+
+namespace Trace
+{
+    struct Event
+    {
+        const char * name;
+        uint64_t begin;
+        uint64_t duration;
+    };
+
+    const size_t CHUNK = 4096;
+
+    struct Chunk
+    {
+        Event events[CHUNK];
+        std::atomic<size_t> count {0};
+        std::atomic<Chunk*> next {nullptr};
+    };
+
+    struct Buffer
+    {
+        Buffer(uint64_t tid)
+        : tid(tid), head(new Chunk), tail(head)
+        {}
+
+        ~Buffer()
+        {
+            Chunk * c = head;
+            while (c != nullptr)
+            {
+                Chunk * n = c->next.load();
+                delete c;
+                c = n;
+            }
+        }
+
+        // owning thread only
+        void record(const char * name, uint64_t begin, uint64_t duration)
+        {
+            size_t i = tail->count.load(std::memory_order_relaxed);
+            if (i == CHUNK)
+            {
+                Chunk * c = new Chunk;
+                tail->next.store(c, std::memory_order_release);
+                tail = c;
+                i = 0;
+            }
+            tail->events[i] = {name, begin, duration};
+            tail->count.store(i+1, std::memory_order_release);
+        }
+
+        uint64_t tid;
+        std::atomic<const char *> threadName {nullptr};
+        Chunk * head;
+        Chunk * tail;
+    };
+
+    inline std::atomic<bool> & enabled()
+    {
+        static std::atomic<bool> on(false);
+        return on;
+    }
+
+    inline void enable(bool on = true) { enabled().store(on, std::memory_order_relaxed); }
+
+    inline bool isEnabled() { return enabled().load(std::memory_order_relaxed); }
+
+    inline std::chrono::steady_clock::time_point epoch()
+    {
+        static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        return start;
+    }
+
+    // microseconds since the first call
+    inline uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>
+        (
+            std::chrono::steady_clock::now()-epoch()
+        ).count();
+    }
+
+    struct Registry
+    {
+        std::mutex lock;
+        std::vector<std::unique_ptr<Buffer>> buffers;
+    };
+
+    inline Registry & registry()
+    {
+        static Registry r;
+        return r;
+    }
+
+    inline Buffer & threadBuffer()
+    {
+        thread_local Buffer * buffer = nullptr;
+        if (buffer == nullptr)
+        {
+            Registry & r = registry();
+            std::lock_guard<std::mutex> guard(r.lock);
+            r.buffers.push_back(std::make_unique<Buffer>(r.buffers.size()));
+            buffer = r.buffers.back().get();
+        }
+        return *buffer;
+    }
+
+    // shown as the thread's name in the viewer
+    inline void setThreadName(const char * name)
+    {
+        threadBuffer().threadName.store(name, std::memory_order_release);
+    }
+
+    class Scope
+    {
+    public:
+
+        Scope(const char * name)
+        : name(isEnabled() ? name : nullptr), begin(this->name != nullptr ? now() : 0)
+        {}
+
+        ~Scope()
+        {
+            if (name != nullptr) { threadBuffer().record(name, begin, now()-begin); }
+        }
+
+    private:
+
+        const char * name;
+        uint64_t begin;
+    };
+
+    inline void writeString(std::ofstream & out, const char * s)
+    {
+        out << '"';
+        for (; *s != '\0'; s++)
+        {
+            if (*s == '"' || *s == '\\') { out << '\\'; }
+            out << *s;
+        }
+        out << '"';
+    }
+
+    // everything recorded so far, from every thread
+    inline void write(std::string path)
+    {
+        std::ofstream out(path);
+        out << "{\"traceEvents\": [\n";
+        bool first = true;
+        Registry & r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        for (const auto & buffer : r.buffers)
+        {
+            const char * threadName = buffer->threadName.load(std::memory_order_acquire);
+            if (threadName != nullptr)
+            {
+                if (!first) { out << ",\n"; }
+                first = false;
+                out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << buffer->tid
+                    << ", \"args\": {\"name\": ";
+                writeString(out, threadName);
+                out << "}}";
+            }
+            for (Chunk * c = buffer->head; c != nullptr; c = c->next.load(std::memory_order_acquire))
+            {
+                const size_t count = c->count.load(std::memory_order_acquire);
+                for (size_t i = 0; i < count; i++)
+                {
+                    const Event & e = c->events[i];
+                    if (!first) { out << ",\n"; }
+                    first = false;
+                    out << "{\"name\": ";
+                    writeString(out, e.name);
+                    out << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << buffer->tid
+                        << ", \"ts\": " << e.begin << ", \"dur\": " << e.duration << "}";
+                }
+            }
+        }
+        out << "\n]}\n";
+    }
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,180 @@
+#include <blockKernel.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    // 8x8 bit matrix transpose, bit k of byte i <-> bit i of byte k
+    inline uint64_t transpose8(uint64_t x)
+    {
+        uint64_t t;
+        t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull; x = x ^ t ^ (t << 7);
+        t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull; x = x ^ t ^ (t << 14);
+        t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull; x = x ^ t ^ (t << 28);
+        return x;
+    }
+
+    // mask of blocks whose random byte, given as 8 bit planes, is below t
+    inline uint32_t lessThan(const uint32_t planes[8], uint8_t t)
+    {
+        if (t == 0) { return 0; }
+        uint32_t lt = 0;
+        uint32_t eq = ~uint32_t(0);
+        for (int k = 7; k >= 0; k--)
+        {
+            if ((t >> k) & 1)
+            {
+                lt |= eq & ~planes[k];
+                eq &= planes[k];
+            }
+            else
+            {
+                eq &= ~planes[k];
+            }
+        }
+        return lt;
+    }
+
+    struct Block
+    {
+        uint32_t tl, tr, bl, br;
+
+        // mask of blocks in state hash
+        inline uint32_t is(uint8_t hash) const
+        {
+            return (hash & 1 ? tl : ~tl) & (hash & 2 ? tr : ~tr)
+                 & (hash & 4 ? bl : ~bl) & (hash & 8 ? br : ~br);
+        }
+
+        // or mask into the cells set in the 4 bit block state value
+        inline void emit(uint32_t mask, uint8_t value)
+        {
+            if (value & 1) { tl |= mask; }
+            if (value & 2) { tr |= mask; }
+            if (value & 4) { bl |= mask; }
+            if (value & 8) { br |= mask; }
+        }
+    };
+}
+
+void blockKernelScalar
+(
+    uint64_t * top,
+    uint64_t * bottom,
+    uint64_t words,
+    const uint8_t * random,
+    const BlockTables & t
+)
+{
+    for (uint64_t k = 0; k < words; k++)
+    {
+        const Block c
+        {
+            compressEvenBits(top[k]),
+            compressEvenBits(top[k] >> 1),
+            compressEvenBits(bottom[k]),
+            compressEvenBits(bottom[k] >> 1)
+        };
+
+        // bit sliced random bytes, plane p bit b is bit p of block b's byte
+        uint64_t r[4];
+        std::memcpy(r, random+32*k, 32);
+        for (int w = 0; w < 4; w++) { r[w] = transpose8(r[w]); }
+        uint32_t planes[8];
+        for (int p = 0; p < 8; p++)
+        {
+            planes[p] = uint32_t((r[0] >> (8*p)) & 0xFF)
+                      | uint32_t((r[1] >> (8*p)) & 0xFF) << 8
+                      | uint32_t((r[2] >> (8*p)) & 0xFF) << 16
+                      | uint32_t((r[3] >> (8*p)) & 0xFF) << 24;
+        }
+
+        Block o {0, 0, 0, 0};
+        for (uint8_t h = 0; h < 16; h++)
+        {
+            const uint32_t m = c.is(h);
+            if (t.a[h] == t.b[h] && t.b[h] == t.c[h])
+            {
+                o.emit(m, t.a[h]);
+                continue;
+            }
+            const uint32_t lt1 = lessThan(planes, t.first[h]);
+            const uint32_t lt2 = lessThan(planes, t.second[h]);
+            o.emit(m & lt1, t.a[h]);
+            o.emit(m & ~lt1 & lt2, t.b[h]);
+            o.emit(m & ~lt1 & ~lt2, t.c[h]);
+        }
+
+        top[k] = spreadEvenBits(o.tl) | (spreadEvenBits(o.tr) << 1);
+        bottom[k] = spreadEvenBits(o.bl) | (spreadEvenBits(o.br) << 1);
+    }
+}
+
+bool kernelSupported(KernelType type)
+{
+    switch (type)
+    {
+        case KernelType::SCALAR:
+            return true;
+#ifdef X86_KERNELS
+        case KernelType::SSE42:
+            return __builtin_cpu_supports("sse4.2");
+        case KernelType::AVX2:
+            return __builtin_cpu_supports("avx2");
+        case KernelType::AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+        default:
+            return false;
+    }
+}
+
+KernelType bestKernel()
+{
+    static const KernelType best = []()
+    {
+        for (KernelType type : {KernelType::AVX512, KernelType::AVX2, KernelType::SSE42})
+        {
+            if (kernelSupported(type)) { return type; }
+        }
+        return KernelType::SCALAR;
+    }();
+    return best;
+}
+
+BlockKernel getKernel(KernelType type)
+{
+    if (!kernelSupported(type))
+    {
+        throw std::runtime_error("Unsupported block kernel: "+to_string(type));
+    }
+    switch (type)
+    {
+#ifdef X86_KERNELS
+        case KernelType::SSE42:
+            return &blockKernelSSE42;
+        case KernelType::AVX2:
+            return &blockKernelAVX2;
+        case KernelType::AVX512:
+            return &blockKernelAVX512;
+#endif
+        default:
+            return &blockKernelScalar;
+    }
+}
+
+std::string to_string(KernelType type)
+{
+    switch (type)
+    {
+        case KernelType::SSE42:
+            return "sse4.2";
+        case KernelType::AVX2:
+            return "avx2";
+        case KernelType::AVX512:
+            return "avx512bw";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,78 @@
+#include <blockKernel.h>
+
+#include <immintrin.h>
+
+void blockKernelAVX2
+(
+    uint64_t * top,
+    uint64_t * bottom,
+    uint64_t words,
+    const uint8_t * random,
+    const BlockTables & t
+)
+{
+    // lane b reads the byte of the word holding block b, then tests its bits
+    const __m256i index = _mm256_setr_epi8
+    (
+        0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+        4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7
+    );
+    const __m256i left = _mm256_set1_epi32(0x40100401);
+    const __m256i right = _mm256_set1_epi32(int(0x80200802u));
+
+    // unsigned compares as signed compares of values offset by 128
+    const __m256i bias = _mm256_set1_epi8(char(0x80));
+
+    const __m256i first = _mm256_xor_si256(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.first)), bias);
+    const __m256i second = _mm256_xor_si256(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.second)), bias);
+    const __m256i a = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.a));
+    const __m256i b = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.b));
+    const __m256i c = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.c));
+
+    const __m256i three = _mm256_set1_epi8(3);
+    const __m256i by4 = _mm256_set1_epi16(0x0401);
+    const __m256i by16 = _mm256_set1_epi32(0x00100001);
+    const __m256i gatherTop = _mm256_setr_epi8
+    (
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+    );
+    const __m256i gatherBottom = _mm256_setr_epi8
+    (
+        -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1
+    );
+
+    for (uint64_t k = 0; k < words; k++)
+    {
+        const __m256i T = _mm256_shuffle_epi8(_mm256_set1_epi64x(top[k]), index);
+        const __m256i B = _mm256_shuffle_epi8(_mm256_set1_epi64x(bottom[k]), index);
+
+        __m256i hash = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(T, left), left), _mm256_set1_epi8(1));
+        hash = _mm256_or_si256(hash, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(T, right), right), _mm256_set1_epi8(2)));
+        hash = _mm256_or_si256(hash, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(B, left), left), _mm256_set1_epi8(4)));
+        hash = _mm256_or_si256(hash, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(B, right), right), _mm256_set1_epi8(8)));
+
+        const __m256i d = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(random+32*k)), bias);
+        const __m256i lt1 = _mm256_cmpgt_epi8(_mm256_shuffle_epi8(first, hash), d);
+        const __m256i lt2 = _mm256_cmpgt_epi8(_mm256_shuffle_epi8(second, hash), d);
+
+        const __m256i out = _mm256_blendv_epi8
+        (
+            _mm256_blendv_epi8(_mm256_shuffle_epi8(c, hash), _mm256_shuffle_epi8(b, hash), lt2),
+            _mm256_shuffle_epi8(a, hash),
+            lt1
+        );
+
+        // pack the 2 bit top and bottom halves of 4 blocks into a byte,
+        // top bytes then bottom bytes in each 128 bit lane
+        const __m256i upper = _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_and_si256(out, three), by4), by16);
+        const __m256i lower = _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_and_si256(_mm256_srli_epi16(out, 2), three), by4), by16);
+        const __m256i packed = _mm256_or_si256(_mm256_shuffle_epi8(upper, gatherTop), _mm256_shuffle_epi8(lower, gatherBottom));
+
+        const uint64_t q0 = _mm256_extract_epi64(packed, 0);
+        const uint64_t q1 = _mm256_extract_epi64(packed, 2);
+        top[k] = (q0 & 0xFFFFFFFFull) | (q1 << 32);
+        bottom[k] = (q0 >> 32) | (q1 & 0xFFFFFFFF00000000ull);
+    }
+}
@@ -0,0 +1,87 @@
+#include <blockKernel.h>
+
+#include <immintrin.h>
+
+namespace
+{
+    // two words' 64 blocks, word 0 in the low 256 bits
+    inline __m512i pair(uint64_t w0, uint64_t w1)
+    {
+        return _mm512_mask_set1_epi64(_mm512_set1_epi64(w0), 0xF0, w1);
+    }
+}
+
+void blockKernelAVX512
+(
+    uint64_t * top,
+    uint64_t * bottom,
+    uint64_t words,
+    const uint8_t * random,
+    const BlockTables & t
+)
+{
+    // lane b reads the byte of the word holding block b, then tests its bits
+    const __m512i index = _mm512_maskz_broadcast_i64x4
+    (
+        0xFF,
+        _mm256_setr_epi8
+        (
+            0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+            4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7
+        )
+    );
+    const __m512i left = _mm512_set1_epi32(0x40100401);
+    const __m512i right = _mm512_set1_epi32(int(0x80200802u));
+
+    const __m512i first = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128((const __m128i*)t.first));
+    const __m512i second = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128((const __m128i*)t.second));
+    const __m512i a = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128((const __m128i*)t.a));
+    const __m512i b = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128((const __m128i*)t.b));
+    const __m512i c = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128((const __m128i*)t.c));
+
+    const __m512i three = _mm512_set1_epi8(3);
+    const __m512i by4 = _mm512_set1_epi16(0x0401);
+    const __m512i by16 = _mm512_set1_epi32(0x00100001);
+    const __m512i gatherTop = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const __m512i gatherBottom = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_setr_epi8(-1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1));
+
+    for (uint64_t k = 0; k < words; k += 2)
+    {
+        const bool tail = k+1 == words;
+
+        const __m512i T = _mm512_shuffle_epi8(pair(top[k], tail ? 0 : top[k+1]), index);
+        const __m512i B = _mm512_shuffle_epi8(pair(bottom[k], tail ? 0 : bottom[k+1]), index);
+
+        __m512i hash = _mm512_maskz_set1_epi8(_mm512_test_epi8_mask(T, left), 1);
+        hash = _mm512_mask_add_epi8(hash, _mm512_test_epi8_mask(T, right), hash, _mm512_set1_epi8(2));
+        hash = _mm512_mask_add_epi8(hash, _mm512_test_epi8_mask(B, left), hash, _mm512_set1_epi8(4));
+        hash = _mm512_mask_add_epi8(hash, _mm512_test_epi8_mask(B, right), hash, _mm512_set1_epi8(8));
+
+        const __mmask64 load = tail ? 0xFFFFFFFFull : ~0ull;
+        const __m512i d = _mm512_maskz_loadu_epi8(load, random+32*k);
+        const __mmask64 lt1 = _mm512_cmplt_epu8_mask(d, _mm512_shuffle_epi8(first, hash));
+        const __mmask64 lt2 = _mm512_cmplt_epu8_mask(d, _mm512_shuffle_epi8(second, hash));
+
+        const __m512i out = _mm512_mask_blend_epi8
+        (
+            lt1,
+            _mm512_mask_blend_epi8(lt2, _mm512_shuffle_epi8(c, hash), _mm512_shuffle_epi8(b, hash)),
+            _mm512_shuffle_epi8(a, hash)
+        );
+
+        // pack the 2 bit top and bottom halves of 4 blocks into a byte,
+        // top bytes then bottom bytes in each 128 bit lane
+        const __m512i upper = _mm512_madd_epi16(_mm512_maddubs_epi16(_mm512_and_si512(out, three), by4), by16);
+        const __m512i lower = _mm512_madd_epi16(_mm512_maddubs_epi16(_mm512_and_si512(_mm512_srli_epi16(out, 2), three), by4), by16);
+        uint64_t q[8];
+        _mm512_storeu_si512(q, _mm512_or_si512(_mm512_shuffle_epi8(upper, gatherTop), _mm512_shuffle_epi8(lower, gatherBottom)));
+
+        top[k] = (q[0] & 0xFFFFFFFFull) | (q[2] << 32);
+        bottom[k] = (q[0] >> 32) | (q[2] & 0xFFFFFFFF00000000ull);
+        if (!tail)
+        {
+            top[k+1] = (q[4] & 0xFFFFFFFFull) | (q[6] << 32);
+            bottom[k+1] = (q[4] >> 32) | (q[6] & 0xFFFFFFFF00000000ull);
+        }
+    }
+}
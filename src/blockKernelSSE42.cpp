@@ -0,0 +1,75 @@
+#include <blockKernel.h>
+
+#include <nmmintrin.h>
+
+void blockKernelSSE42
+(
+    uint64_t * top,
+    uint64_t * bottom,
+    uint64_t words,
+    const uint8_t * random,
+    const BlockTables & t
+)
+{
+    // lane b reads the byte of the word holding block b, then tests its bits
+    const __m128i index[2] =
+    {
+        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+        _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7)
+    };
+    const __m128i left = _mm_set1_epi32(0x40100401);
+    const __m128i right = _mm_set1_epi32(int(0x80200802u));
+
+    // unsigned compares as signed compares of values offset by 128
+    const __m128i bias = _mm_set1_epi8(char(0x80));
+
+    const __m128i first = _mm_xor_si128(_mm_loadu_si128((const __m128i*)t.first), bias);
+    const __m128i second = _mm_xor_si128(_mm_loadu_si128((const __m128i*)t.second), bias);
+    const __m128i a = _mm_loadu_si128((const __m128i*)t.a);
+    const __m128i b = _mm_loadu_si128((const __m128i*)t.b);
+    const __m128i c = _mm_loadu_si128((const __m128i*)t.c);
+
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i by4 = _mm_set1_epi16(0x0401);
+    const __m128i by16 = _mm_set1_epi32(0x00100001);
+    const __m128i gatherTop = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i gatherBottom = _mm_setr_epi8(-1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    for (uint64_t k = 0; k < words; k++)
+    {
+        uint64_t packedTop = 0, packedBottom = 0;
+
+        for (int half = 0; half < 2; half++)
+        {
+            const __m128i T = _mm_shuffle_epi8(_mm_set1_epi64x(top[k]), index[half]);
+            const __m128i B = _mm_shuffle_epi8(_mm_set1_epi64x(bottom[k]), index[half]);
+
+            __m128i hash = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(T, left), left), _mm_set1_epi8(1));
+            hash = _mm_or_si128(hash, _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(T, right), right), _mm_set1_epi8(2)));
+            hash = _mm_or_si128(hash, _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(B, left), left), _mm_set1_epi8(4)));
+            hash = _mm_or_si128(hash, _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(B, right), right), _mm_set1_epi8(8)));
+
+            const __m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(random+32*k+16*half)), bias);
+            const __m128i lt1 = _mm_cmpgt_epi8(_mm_shuffle_epi8(first, hash), d);
+            const __m128i lt2 = _mm_cmpgt_epi8(_mm_shuffle_epi8(second, hash), d);
+
+            const __m128i out = _mm_blendv_epi8
+            (
+                _mm_blendv_epi8(_mm_shuffle_epi8(c, hash), _mm_shuffle_epi8(b, hash), lt2),
+                _mm_shuffle_epi8(a, hash),
+                lt1
+            );
+
+            // pack the 2 bit top and bottom halves of 4 blocks into a byte
+            const __m128i upper = _mm_madd_epi16(_mm_maddubs_epi16(_mm_and_si128(out, three), by4), by16);
+            const __m128i lower = _mm_madd_epi16(_mm_maddubs_epi16(_mm_and_si128(_mm_srli_epi16(out, 2), three), by4), by16);
+            const uint64_t q = _mm_cvtsi128_si64(_mm_or_si128(_mm_shuffle_epi8(upper, gatherTop), _mm_shuffle_epi8(lower, gatherBottom)));
+
+            packedTop |= (q & 0xFFFFFFFFull) << (32*half);
+            packedBottom |= (q >> 32) << (32*half);
+        }
+
+        top[k] = packedTop;
+        bottom[k] = packedBottom;
+    }
+}
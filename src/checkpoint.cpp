@@ -0,0 +1,562 @@
+#include <checkpoint.h>
+#include <trace.h>
+
+#include <zlib.h>
+
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+    const char MAGIC[8] = {'S', 'N', 'O', 'W', 'C', 'K', 'P', 'T'};
+    const uint32_t VERSION = 1;
+    const uint64_t TILE = MargolusEngine::TILE;
+    // tiles coded per batch, bounding the memory held while streaming
+    const uint64_t BATCH = 1024;
+
+    void put32(std::vector<uint8_t> & out, uint32_t v)
+    {
+        for (unsigned b = 0; b < 4; b++) { out.push_back(uint8_t(v >> (8*b))); }
+    }
+
+    void put64(std::vector<uint8_t> & out, uint64_t v)
+    {
+        for (unsigned b = 0; b < 8; b++) { out.push_back(uint8_t(v >> (8*b))); }
+    }
+
+    void putFloat(std::vector<uint8_t> & out, float f)
+    {
+        uint32_t v;
+        std::memcpy(&v, &f, sizeof(v));
+        put32(out, v);
+    }
+
+    uint32_t get32(const uint8_t * in)
+    {
+        uint32_t v = 0;
+        for (unsigned b = 0; b < 4; b++) { v |= uint32_t(in[b]) << (8*b); }
+        return v;
+    }
+
+    uint64_t get64(const uint8_t * in)
+    {
+        uint64_t v = 0;
+        for (unsigned b = 0; b < 8; b++) { v |= uint64_t(in[b]) << (8*b); }
+        return v;
+    }
+
+    float getFloat(const uint8_t * in)
+    {
+        uint32_t v = get32(in);
+        float f;
+        std::memcpy(&f, &v, sizeof(f));
+        return f;
+    }
+
+    void putVarint(std::vector<uint8_t> & out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(uint8_t(v));
+    }
+
+    // set bits [begin, end) of the row major words
+    void fillBits(uint64_t * words, uint64_t begin, uint64_t end)
+    {
+        while (begin < end)
+        {
+            const uint64_t k = begin/64;
+            const uint64_t lo = begin%64;
+            const uint64_t hi = std::min(end-k*64, uint64_t(64));
+            const uint64_t mask = (hi == 64 ? ~uint64_t(0) : (uint64_t(1) << hi)-1) & ~((uint64_t(1) << lo)-1);
+            words[k] |= mask;
+            begin = k*64+hi;
+        }
+    }
+
+    void runInPool(uint64_t n, jThread::ThreadPool * pool, const std::function<void(size_t)> & fn)
+    {
+        if (pool != nullptr) { pool->parallel_for(0, n, 1, fn); }
+        else
+        {
+            for (uint64_t i = 0; i < n; i++) { fn(i); }
+        }
+    }
+
+    std::unique_ptr<jThread::ThreadPool> makePool(unsigned threads)
+    {
+        // the calling thread codes tiles too
+        if (threads > 1) { return std::make_unique<jThread::ThreadPool>(threads-1); }
+        return nullptr;
+    }
+}
+
+void encodeTile(const uint64_t * words, uint64_t rows, std::vector<uint8_t> & out, bool zlib)
+{
+    // every run but the last costs a byte at least, so with as many
+    // changes of bit as the tile has bytes the words are stored as they are
+    uint64_t changes = 0;
+    uint64_t carry = 0;
+    for (uint64_t r = 0; r < rows; r++)
+    {
+        changes += __builtin_popcountll(words[r] ^ ((words[r] << 1) | carry));
+        carry = words[r] >> 63;
+    }
+    if (changes >= rows*sizeof(uint64_t))
+    {
+        put32(out, rows*sizeof(uint64_t));
+        put32(out, RAW_TILE);
+        for (uint64_t r = 0; r < rows; r++)
+        {
+            for (unsigned b = 0; b < 8; b++) { out.push_back(uint8_t(words[r] >> (8*b))); }
+        }
+        return;
+    }
+
+    std::vector<uint8_t> runs;
+    uint64_t bit = 0;
+    uint64_t run = 0;
+    for (uint64_t r = 0; r < rows; r++)
+    {
+        uint64_t v = words[r];
+        uint64_t rest = 64;
+        while (rest > 0)
+        {
+            // first bit differing from the current run
+            uint64_t x = bit ? ~v : v;
+            if (rest < 64) { x &= (uint64_t(1) << rest)-1; }
+            if (x == 0)
+            {
+                run += rest;
+                break;
+            }
+            const uint64_t n = __builtin_ctzll(x);
+            putVarint(runs, run+n);
+            run = 0;
+            bit ^= 1;
+            v >>= n;
+            rest -= n;
+        }
+    }
+
+    put32(out, runs.size());
+    if (runs.empty() || !zlib)
+    {
+        put32(out, 0);
+        out.insert(out.end(), runs.begin(), runs.end());
+        return;
+    }
+
+    // one stream per thread, reset per tile, as setting one up costs more
+    // than deflating a tile
+    struct Deflater
+    {
+        Deflater()
+        {
+            std::memset(&stream, 0, sizeof(stream));
+            deflateInit2(&stream, 1, Z_DEFLATED, 13, 8, Z_DEFAULT_STRATEGY);
+        }
+        ~Deflater() { deflateEnd(&stream); }
+        z_stream stream;
+    };
+    thread_local Deflater deflater;
+    z_stream & stream = deflater.stream;
+
+    const size_t at = out.size();
+    put32(out, 0);
+    out.resize(at+4+runs.size());
+    deflateReset(&stream);
+    stream.next_in = runs.data();
+    stream.avail_in = runs.size();
+    // anything not smaller is stored as is
+    stream.next_out = out.data()+at+4;
+    stream.avail_out = runs.size()-1;
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+    {
+        const uint32_t zBytes = stream.total_out;
+        out.resize(at+4+zBytes);
+        for (unsigned b = 0; b < 4; b++) { out[at+b] = uint8_t(zBytes >> (8*b)); }
+    }
+    else
+    {
+        std::memcpy(out.data()+at+4, runs.data(), runs.size());
+    }
+}
+
+void decodeTile(const uint8_t * data, uint32_t rleBytes, uint32_t zBytes, uint64_t * words, uint64_t rows)
+{
+    if (zBytes == RAW_TILE)
+    {
+        if (rleBytes != rows*sizeof(uint64_t)) { throw std::runtime_error("Corrupt checkpoint tile"); }
+        for (uint64_t r = 0; r < rows; r++)
+        {
+            uint64_t v = 0;
+            for (unsigned b = 0; b < 8; b++) { v |= uint64_t(data[8*r+b]) << (8*b); }
+            words[r] = v;
+        }
+        return;
+    }
+
+    std::fill(words, words+rows, 0);
+    if (rleBytes == 0) { return; }
+
+    std::vector<uint8_t> inflated;
+    const uint8_t * runs = data;
+    if (zBytes > 0)
+    {
+        inflated.resize(rleBytes);
+        uLongf n = rleBytes;
+        if (uncompress(inflated.data(), &n, data, zBytes) != Z_OK || n != rleBytes)
+        {
+            throw std::runtime_error("Corrupt checkpoint tile");
+        }
+        runs = inflated.data();
+    }
+
+    const uint64_t bits = rows*64;
+    uint64_t position = 0;
+    uint64_t bit = 0;
+    uint32_t i = 0;
+    while (i < rleBytes)
+    {
+        uint64_t run = 0;
+        unsigned shift = 0;
+        while (true)
+        {
+            if (i >= rleBytes || shift > 63) { throw std::runtime_error("Corrupt checkpoint tile"); }
+            const uint8_t b = runs[i++];
+            run |= uint64_t(b & 0x7f) << shift;
+            shift += 7;
+            if ((b & 0x80) == 0) { break; }
+        }
+        if (run > bits-position) { throw std::runtime_error("Corrupt checkpoint tile"); }
+        if (bit) { fillBits(words, position, position+run); }
+        position += run;
+        bit ^= 1;
+    }
+    // the implied last run
+    if (bit) { fillBits(words, position, bits); }
+}
+
+void saveCheckpoint
+(
+    std::string path,
+    const Checkpoint & header,
+    unsigned planes,
+    TileSource source,
+    unsigned threads
+)
+{
+    Trace::Scope scope("saveCheckpoint");
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open checkpoint "+path+" for writing");
+    }
+
+    std::vector<uint8_t> out(MAGIC, MAGIC+8);
+    put32(out, VERSION);
+    put32(out, planes);
+    put64(out, header.width);
+    put64(out, header.height);
+    put32(out, header.type);
+    put64(out, header.seed);
+    put64(out, header.steps);
+    const MargolusEngine::Parameters & p = header.parameters;
+    for (float f : {p.p1, p.p2, p.p31, p.p32, p.p6, p.p7, p.p9, p.p11, p.spawnProb})
+    {
+        putFloat(out, f);
+    }
+    put32(out, TILE);
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+
+    const uint64_t tilesX = header.width/TILE;
+    const uint64_t tilesY = (header.height+TILE-1)/TILE;
+    const uint64_t tileRows = std::max(uint64_t(1), BATCH/std::max(tilesX*planes, uint64_t(1)));
+    std::unique_ptr<jThread::ThreadPool> pool = makePool(threads);
+
+    std::vector<std::vector<uint8_t>> coded;
+    for (uint64_t ty0 = 0; ty0 < tilesY; ty0 += tileRows)
+    {
+        const uint64_t ty1 = std::min(ty0+tileRows, tilesY);
+        const uint64_t n = (ty1-ty0)*tilesX*planes;
+        coded.resize(n);
+        runInPool
+        (
+            n,
+            pool.get(),
+            [&](size_t i)
+            {
+                const unsigned plane = i % planes;
+                const uint64_t tx = (i/planes) % tilesX;
+                const uint64_t ty = ty0+i/(planes*tilesX);
+                const uint64_t rows = std::min(TILE, header.height-ty*TILE);
+                uint64_t words[TILE];
+                source(plane, tx, ty, words);
+                coded[i].clear();
+                encodeTile(words, rows, coded[i]);
+            }
+        );
+        for (uint64_t i = 0; i < n; i++)
+        {
+            file.write(reinterpret_cast<const char*>(coded[i].data()), coded[i].size());
+        }
+    }
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Could not write checkpoint "+path);
+    }
+}
+
+void saveCheckpoint(std::string path, const Checkpoint & checkpoint, unsigned threads)
+{
+    for (const BitGrid & plane : checkpoint.planes)
+    {
+        if (plane.getWidth() != checkpoint.width || plane.getHeight() != checkpoint.height)
+        {
+            throw std::runtime_error("Checkpoint plane size does not match its header");
+        }
+    }
+    saveCheckpoint
+    (
+        path,
+        checkpoint,
+        checkpoint.planes.size(),
+        [&checkpoint](unsigned plane, uint64_t tx, uint64_t ty, uint64_t * words)
+        {
+            const BitGrid & grid = checkpoint.planes[plane];
+            const uint64_t rows = std::min(TILE, grid.getHeight()-ty*TILE);
+            for (uint64_t r = 0; r < rows; r++) { words[r] = grid.row(ty*TILE+r)[tx]; }
+        },
+        threads
+    );
+}
+
+void saveCheckpoint(std::string path, Snapshot & snapshot, unsigned threads)
+{
+    Checkpoint header;
+    header.width = snapshot.getWidth();
+    header.height = snapshot.getHeight();
+    header.type = snapshot.getType();
+    header.seed = snapshot.getSeed();
+    header.steps = snapshot.getSteps();
+    header.parameters = snapshot.getParameters();
+    saveCheckpoint
+    (
+        path,
+        header,
+        1,
+        [&snapshot](unsigned plane, uint64_t tx, uint64_t ty, uint64_t * words)
+        {
+            snapshot.tile(tx, ty, words);
+        },
+        threads
+    );
+}
+
+Checkpoint checkpoint(const MargolusEngine & engine)
+{
+    Checkpoint c;
+    c.width = engine.getWidth();
+    c.height = engine.getHeight();
+    c.type = engine.getType();
+    c.seed = engine.getSeed();
+    c.steps = engine.getSteps();
+    c.parameters = engine.getParameters();
+    c.planes.push_back(engine.getCells());
+    return c;
+}
+
+Checkpoint loadCheckpoint(std::string path, unsigned threads)
+{
+    Trace::Scope scope("loadCheckpoint");
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open checkpoint "+path);
+    }
+
+    const size_t headerBytes = 8+4+4+8+8+4+8+8+9*4+4;
+    uint8_t in[headerBytes];
+    if (!file.read(reinterpret_cast<char*>(in), headerBytes) || std::memcmp(in, MAGIC, 8) != 0)
+    {
+        throw std::runtime_error(path+" is not a checkpoint");
+    }
+    if (get32(in+8) != VERSION)
+    {
+        throw std::runtime_error("Unsupported checkpoint version in "+path);
+    }
+
+    Checkpoint c;
+    const unsigned planes = get32(in+12);
+    c.width = get64(in+16);
+    c.height = get64(in+24);
+    c.type = get32(in+32);
+    c.seed = get64(in+36);
+    c.steps = get64(in+44);
+    MargolusEngine::Parameters & p = c.parameters;
+    float * fields[] = {&p.p1, &p.p2, &p.p31, &p.p32, &p.p6, &p.p7, &p.p9, &p.p11, &p.spawnProb};
+    for (unsigned f = 0; f < 9; f++) { *fields[f] = getFloat(in+52+4*f); }
+    if (get32(in+88) != TILE)
+    {
+        throw std::runtime_error("Checkpoint "+path+" has an unsupported tile size");
+    }
+    // checked before any plane is allocated from them
+    if ((planes != 1 && planes != 2) || c.width == 0 || c.width % TILE != 0 || c.height == 0)
+    {
+        throw std::runtime_error("Corrupt checkpoint header in "+path);
+    }
+
+    for (unsigned plane = 0; plane < planes; plane++) { c.planes.emplace_back(c.width, c.height); }
+
+    const uint64_t tilesX = c.width/TILE;
+    const uint64_t tilesY = (c.height+TILE-1)/TILE;
+    const uint64_t tileRows = std::max(uint64_t(1), BATCH/std::max(tilesX*planes, uint64_t(1)));
+    std::unique_ptr<jThread::ThreadPool> pool = makePool(threads);
+
+    struct Coded
+    {
+        uint32_t rleBytes, zBytes;
+        std::vector<uint8_t> data;
+    };
+    std::vector<Coded> coded;
+    for (uint64_t ty0 = 0; ty0 < tilesY; ty0 += tileRows)
+    {
+        const uint64_t ty1 = std::min(ty0+tileRows, tilesY);
+        const uint64_t n = (ty1-ty0)*tilesX*planes;
+        coded.resize(n);
+        for (uint64_t i = 0; i < n; i++)
+        {
+            uint8_t sizes[8];
+            if (!file.read(reinterpret_cast<char*>(sizes), 8))
+            {
+                throw std::runtime_error("Checkpoint "+path+" is truncated");
+            }
+            coded[i].rleBytes = get32(sizes);
+            coded[i].zBytes = get32(sizes+4);
+            coded[i].data.resize(codedTileBytes(coded[i].rleBytes, coded[i].zBytes));
+            if (!file.read(reinterpret_cast<char*>(coded[i].data.data()), coded[i].data.size()))
+            {
+                throw std::runtime_error("Checkpoint "+path+" is truncated");
+            }
+        }
+        runInPool
+        (
+            n,
+            pool.get(),
+            [&](size_t i)
+            {
+                const unsigned plane = i % planes;
+                const uint64_t tx = (i/planes) % tilesX;
+                const uint64_t ty = ty0+i/(planes*tilesX);
+                const uint64_t rows = std::min(TILE, c.height-ty*TILE);
+                uint64_t words[TILE];
+                decodeTile(coded[i].data.data(), coded[i].rleBytes, coded[i].zBytes, words, rows);
+                BitGrid & grid = c.planes[plane];
+                for (uint64_t r = 0; r < rows; r++) { grid.row(ty*TILE+r)[tx] = words[r]; }
+            }
+        );
+    }
+
+    return c;
+}
+
+CheckpointWriter::CheckpointWriter()
+: terminate(false), saved(0)
+{
+    thread = std::thread(&CheckpointWriter::main, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        terminate = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+bool CheckpointWriter::idle()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return pending == nullptr;
+}
+
+uint64_t CheckpointWriter::getSaved()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return saved;
+}
+
+bool CheckpointWriter::save(std::string path, std::shared_ptr<Snapshot> snapshot)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (error != nullptr)
+        {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+        if (pending != nullptr) { return false; }
+        this->path = path;
+        pending = snapshot;
+    }
+    condition.notify_all();
+    return true;
+}
+
+void CheckpointWriter::wait()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    condition.wait(guard, [this] { return pending == nullptr; });
+    if (error != nullptr)
+    {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void CheckpointWriter::main()
+{
+    if (Trace::isEnabled()) { Trace::setThreadName("CheckpointWriter"); }
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        condition.wait(guard, [this] { return terminate || pending != nullptr; });
+        // a pending save is finished before stopping
+        if (pending == nullptr) { return; }
+
+        const std::string target = path;
+        std::shared_ptr<Snapshot> snapshot = pending;
+        guard.unlock();
+        std::exception_ptr failed = nullptr;
+        try
+        {
+            // one thread, leaving the cores to the engine
+            saveCheckpoint(target+".partial", *snapshot, 1);
+            if (std::rename((target+".partial").c_str(), target.c_str()) != 0)
+            {
+                throw std::runtime_error("Could not rename checkpoint to "+target);
+            }
+        }
+        catch (...)
+        {
+            failed = std::current_exception();
+        }
+        snapshot.reset();
+        guard.lock();
+        pending = nullptr;
+        if (failed != nullptr) { error = failed; }
+        else { saved++; }
+        condition.notify_all();
+    }
+}
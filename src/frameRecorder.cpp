@@ -0,0 +1,216 @@
+#include <frameRecorder.h>
+#include <trace.h>
+
+#include <png.h>
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+FrameRecorder::FrameRecorder
+(
+    std::string prefix,
+    unsigned workers,
+    size_t capacity,
+    Policy policy,
+    Palette palette
+)
+: prefix(prefix), capacity(std::max(capacity, size_t(1))), policy(policy), palette(palette),
+  inFlight(0), offered(0), decimation(1), taken(0), skipped(0), written(0), terminate(false),
+  pool(std::make_unique<jThread::ThreadPool>(std::max(workers, 1u)))
+{
+    writer = std::thread(&FrameRecorder::writeLoop, this);
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    // jobs may still be returning after their frame is handed on
+    pool->wait();
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        condition.wait(guard, [this] { return inFlight == 0; });
+        terminate = true;
+    }
+    condition.notify_all();
+    writer.join();
+}
+
+bool FrameRecorder::admit()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    offered++;
+    if (policy == Policy::DECIMATE && decimation > 1 && inFlight <= capacity/2)
+    {
+        decimation /= 2;
+    }
+    if (offered % decimation != 0)
+    {
+        skipped++;
+        return false;
+    }
+    if (inFlight >= capacity)
+    {
+        if (policy == Policy::DECIMATE) { decimation *= 2; }
+        skipped++;
+        return false;
+    }
+    inFlight++;
+    taken++;
+    return true;
+}
+
+bool FrameRecorder::push(uint64_t step, const BitGrid & cells)
+{
+    if (!admit()) { return false; }
+    std::shared_ptr<BitGrid> frame = std::make_shared<BitGrid>(cells);
+    pool->queueJob([this, step, frame]() { encodeJob(step, frame); });
+    return true;
+}
+
+bool FrameRecorder::push(uint64_t step, BitGrid && cells)
+{
+    if (!admit()) { return false; }
+    std::shared_ptr<BitGrid> frame = std::make_shared<BitGrid>(std::move(cells));
+    pool->queueJob([this, step, frame]() { encodeJob(step, frame); });
+    return true;
+}
+
+void FrameRecorder::finish()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    condition.wait(guard, [this] { return inFlight == 0; });
+}
+
+uint64_t FrameRecorder::getTaken()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return taken;
+}
+
+uint64_t FrameRecorder::getSkipped()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return skipped;
+}
+
+uint64_t FrameRecorder::getWritten()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return written;
+}
+
+namespace
+{
+    void appendPNG(png_structp png, png_bytep data, png_size_t n)
+    {
+        std::vector<uint8_t> * out = reinterpret_cast<std::vector<uint8_t>*>(png_get_io_ptr(png));
+        out->insert(out->end(), data, data+n);
+    }
+}
+
+std::vector<uint8_t> FrameRecorder::encode(const BitGrid & cells, const Palette & palette)
+{
+    /*
+        The palette is the colour map: a 1 bit paletted PNG, so a row is
+        just the grid's row words as little endian bytes, with packswap
+        for the grid's least significant bit first order.
+    */
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> row(cells.getWordsPerRow()*sizeof(uint64_t));
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png == NULL) { throw std::runtime_error("Could not create a PNG writer"); }
+    png_infop info = png_create_info_struct(png);
+    if (info == NULL || setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        throw std::runtime_error("Could not encode PNG frame");
+    }
+
+    png_set_write_fn(png, &out, appendPNG, NULL);
+    png_set_IHDR
+    (
+        png, info,
+        cells.getWidth(), cells.getHeight(),
+        1, PNG_COLOR_TYPE_PALETTE,
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
+    );
+    png_color colours[2] =
+    {
+        {palette.empty[0], palette.empty[1], palette.empty[2]},
+        {palette.particle[0], palette.particle[1], palette.particle[2]}
+    };
+    png_set_PLTE(png, info, colours, 2);
+    png_set_compression_level(png, 1);
+    png_set_filter(png, 0, PNG_FILTER_NONE);
+    png_write_info(png, info);
+    png_set_packswap(png);
+
+    for (uint64_t j = 0; j < cells.getHeight(); j++)
+    {
+        const uint64_t * words = cells.row(j);
+        for (uint64_t k = 0; k < cells.getWordsPerRow(); k++)
+        {
+            for (unsigned b = 0; b < 8; b++) { row[8*k+b] = uint8_t(words[k] >> (8*b)); }
+        }
+        png_write_row(png, row.data());
+    }
+
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    return out;
+}
+
+void FrameRecorder::encodeJob(uint64_t step, std::shared_ptr<BitGrid> cells)
+{
+    Trace::Scope scope("FrameRecorder::encode");
+    Encoded e {step, {}};
+    try
+    {
+        e.png = encode(*cells, palette);
+    }
+    catch (const std::exception & error)
+    {
+        std::cout << "Frame " << step << " not recorded: " << error.what() << "\n";
+    }
+    cells.reset();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        encoded.push_back(std::move(e));
+    }
+    condition.notify_all();
+}
+
+void FrameRecorder::writeLoop()
+{
+    if (Trace::isEnabled()) { Trace::setThreadName("FrameRecorder writer"); }
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        condition.wait(guard, [this] { return terminate || !encoded.empty(); });
+        if (encoded.empty()) { return; }
+
+        Encoded e = std::move(encoded.front());
+        encoded.pop_front();
+        guard.unlock();
+
+        bool ok = false;
+        if (!e.png.empty())
+        {
+            Trace::Scope scope("FrameRecorder::write");
+            std::stringstream path;
+            path << prefix << std::setw(9) << std::setfill('0') << e.step << ".png";
+            std::ofstream file(path.str(), std::ios::binary);
+            file.write(reinterpret_cast<const char*>(e.png.data()), e.png.size());
+            ok = file.good();
+            if (!ok) { std::cout << "Could not write frame " << path.str() << "\n"; }
+        }
+
+        guard.lock();
+        if (ok) { written++; }
+        inFlight--;
+        condition.notify_all();
+    }
+}
@@ -0,0 +1,283 @@
+#include <margolusEngine.h>
+#include <checkpoint.h>
+#include <frameRecorder.h>
+#include <recording.h>
+#include <trace.h>
+#include <perfCounters.h>
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+int main(int argv, char ** argc)
+{
+
+    int durationSeconds = 10;
+    int cells = 256;
+    float density = 0.1f;
+    uint64_t seed = std::random_device()();
+    KernelType kernel = bestKernel();
+    unsigned threads = 1;
+    bool tileTracking = true;
+    std::string tracePath = "";
+    // checkpoint to start from instead of a random fill, and to write at exit
+    std::string loadPath = "";
+    std::string savePath = "";
+    // also save to savePath this often while running, from a snapshot
+    double autosaveSeconds = 0.0;
+    // PNG frames written as framesPrefix000000123.png, the cells after 123
+    // steps, one every frameSteps steps
+    std::string framesPrefix = "";
+    uint64_t frameSteps = 1;
+    unsigned frameWorkers = 1;
+    FrameRecorder::Policy framePolicy = FrameRecorder::Policy::DECIMATE;
+    // a delta coded recording of every recordSteps-th step, see particles-playback,
+    // frames the writer cannot keep up with folded into the next
+    std::string recordPath = "";
+    uint64_t recordSteps = 1;
+    uint64_t keyFrames = 1024;
+
+    if (argv >= 3)
+    {
+        std::map<std::string, std::string> args;
+        std::vector<std::string> inputs;
+        for (int i = 1; i < argv; i++)
+        {
+            inputs.push_back(argc[i]);
+        }
+        std::reverse(inputs.begin(), inputs.end());
+        while (inputs.size() >= 2)
+        {
+            std::string arg = inputs.back();
+            inputs.pop_back();
+            args[arg] = inputs.back();
+            inputs.pop_back();
+        }
+
+        if (args.find("-durationSeconds") != args.end())
+        {
+            durationSeconds = std::stoi(args["-durationSeconds"]);
+        }
+        if (args.find("-cells") != args.end())
+        {
+            cells = std::stoi(args["-cells"]);
+        }
+        if (args.find("-density") != args.end())
+        {
+            density = std::stof(args["-density"]);
+        }
+        if (args.find("-seed") != args.end())
+        {
+            seed = std::stoull(args["-seed"]);
+        }
+        if (args.find("-threads") != args.end())
+        {
+            threads = std::stoi(args["-threads"]);
+        }
+        if (args.find("-tileTracking") != args.end())
+        {
+            tileTracking = std::stoi(args["-tileTracking"]) != 0;
+        }
+        if (args.find("-trace") != args.end())
+        {
+            tracePath = args["-trace"];
+        }
+        if (args.find("-load") != args.end())
+        {
+            loadPath = args["-load"];
+        }
+        if (args.find("-save") != args.end())
+        {
+            savePath = args["-save"];
+        }
+        if (args.find("-autosaveSeconds") != args.end())
+        {
+            autosaveSeconds = std::stod(args["-autosaveSeconds"]);
+        }
+        if (args.find("-frames") != args.end())
+        {
+            framesPrefix = args["-frames"];
+        }
+        if (args.find("-frameSteps") != args.end())
+        {
+            frameSteps = std::max(std::stoull(args["-frameSteps"]), 1ull);
+        }
+        if (args.find("-frameWorkers") != args.end())
+        {
+            frameWorkers = std::stoi(args["-frameWorkers"]);
+        }
+        if (args.find("-framePolicy") != args.end())
+        {
+            if (args["-framePolicy"] == "drop") { framePolicy = FrameRecorder::Policy::DROP; }
+        }
+        if (args.find("-record") != args.end())
+        {
+            recordPath = args["-record"];
+        }
+        if (args.find("-recordSteps") != args.end())
+        {
+            recordSteps = std::max(std::stoull(args["-recordSteps"]), 1ull);
+        }
+        if (args.find("-keyFrames") != args.end())
+        {
+            keyFrames = std::stoull(args["-keyFrames"]);
+        }
+        if (args.find("-kernel") != args.end())
+        {
+            for (KernelType type : {KernelType::SCALAR, KernelType::SSE42, KernelType::AVX2, KernelType::AVX512})
+            {
+                if (to_string(type) == args["-kernel"]) { kernel = type; }
+            }
+        }
+    }
+
+    if (tracePath != "")
+    {
+        Trace::enable();
+        Trace::setThreadName("main");
+    }
+
+    // before the engine, so its pool threads are counted too
+    PerfCounters counters;
+
+    Checkpoint initial;
+    initial.width = cells;
+    initial.height = cells;
+    initial.seed = seed;
+    if (loadPath != "")
+    {
+        auto tic = std::chrono::steady_clock::now();
+        initial = loadCheckpoint(loadPath, threads);
+        std::cout << "Loaded " << loadPath << " at step " << initial.steps << " in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now()-tic).count() << " s\n";
+    }
+
+    MargolusEngine engine(initial.width, initial.height, initial.parameters, initial.seed);
+    engine.setKernel(kernel);
+    engine.setThreads(threads);
+    engine.setTileTracking(tileTracking);
+
+    if (loadPath != "")
+    {
+        engine.restore(initial.planes[0], initial.type, initial.steps);
+        initial.planes.clear();
+    }
+    else
+    {
+        std::mt19937 fill(seed);
+        std::uniform_real_distribution<float> U;
+        for (int j = 0; j < cells; j++)
+        {
+            for (int i = 0; i < cells; i++)
+            {
+                engine.set(i, j, U(fill) < density);
+            }
+        }
+    }
+
+    const uint64_t startSteps = engine.getSteps();
+    const double gridCells = double(engine.getWidth())*engine.getHeight();
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(durationSeconds);
+
+    CheckpointWriter writer;
+    std::unique_ptr<FrameRecorder> frames;
+    std::unique_ptr<RecordingWriter> recording;
+    if (recordPath != "")
+    {
+        recording = std::make_unique<RecordingWriter>(recordPath, engine, keyFrames);
+    }
+    if (framesPrefix != "")
+    {
+        frames = std::make_unique<FrameRecorder>(framesPrefix, frameWorkers, 8, framePolicy);
+    }
+    const bool autosave = savePath != "" && autosaveSeconds > 0.0;
+    const auto autosaveInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>
+    (
+        std::chrono::duration<double>(autosaveSeconds)
+    );
+    auto nextAutosave = start+autosaveInterval;
+
+    counters.start();
+    while (true)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= end) { break; }
+        if (autosave && now >= nextAutosave && writer.idle())
+        {
+            writer.save(savePath, engine.takeSnapshot());
+            nextAutosave = now+autosaveInterval;
+        }
+        if (frames && engine.getSteps() % frameSteps == 0)
+        {
+            frames->push(engine.getSteps(), engine.getCells());
+        }
+        if (recording && engine.getSteps() % recordSteps == 0)
+        {
+            recording->frame(engine);
+        }
+        engine.step();
+    }
+    if (recording) { recording->frame(engine, true); }
+    const std::vector<PerfCounters::Counter> & counts = counters.stop();
+    writer.wait();
+    if (frames) { frames->finish(); }
+    if (recording) { recording->close(); }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    const double steps = engine.getSteps()-startSteps;
+
+    std::cout << "Kernel: " << to_string(kernel)
+              << ", threads: " << engine.getThreads()
+              << ", steps: " << steps
+              << ", steps/s: " << steps/elapsed
+              << ", cell updates/s: " << steps*gridCells/elapsed
+              << ", active tiles: " << engine.getActiveTiles();
+    if (autosave) { std::cout << ", autosaves: " << writer.getSaved(); }
+    if (frames)
+    {
+        std::cout << ", frames written: " << frames->getWritten()
+                  << ", skipped: " << frames->getSkipped();
+    }
+    if (recording)
+    {
+        std::cout << ", recorded frames: " << recording->getFrames()
+                  << ", skipped: " << recording->getSkipped()
+                  << ", changed: " << recording->getWritten()
+                  << ", keyframes: " << recording->getKeys();
+    }
+    std::cout << "\n";
+
+    const double updates = steps*gridCells;
+    if (counters.anyAvailable())
+    {
+        std::cout << "Per cell update:";
+        for (const PerfCounters::Counter & c : counts)
+        {
+            std::cout << " " << c.name << ": ";
+            if (c.available) { std::cout << c.value/updates; }
+            else { std::cout << "unavailable"; }
+            std::cout << (&c == &counts.back() ? "\n" : ",");
+        }
+    }
+    else
+    {
+        std::cout << "Hardware counters unavailable\n";
+    }
+
+    if (savePath != "")
+    {
+        auto tic = std::chrono::steady_clock::now();
+        saveCheckpoint(savePath, checkpoint(engine), threads);
+        std::cout << "Saved " << savePath << " at step " << engine.getSteps() << " in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now()-tic).count() << " s\n";
+    }
+
+    if (tracePath != "") { Trace::write(tracePath); }
+
+    return 0;
+}
@@ -4,6 +4,30 @@ int main(int argv, char ** argc)
 {
 
     int durationSeconds = 10;
+    uint64_t seed = std::random_device()();
+    // one pass per step, or the original toMargolus, blockCA, fromMargolus passes
+    bool fused = true;
+    // no window, an EGL or OSMesa context, running unpaused for durationSeconds
+    bool headless = false;
+    // a fixed scenario, unpaused and uncapped, for durationSeconds or maxSteps
+    bool benchmark = false;
+    uint64_t maxSteps = 0;
+    std::string benchmarkFormat = "json";
+    // per pass CPU and GPU times, printed with the FPS
+    bool timing = false;
+    // Chrome trace written here at exit, or when T is pressed
+    std::string tracePath = "";
+    // checkpoint of the cells and obstacles to start from, and to write at exit
+    std::string loadPath = "";
+    std::string savePath = "";
+    // input events and the seed written here at exit
+    std::string recordPath = "";
+    // a recorded journal to run instead of taking input, unpaused and uncapped
+    std::string replayPath = "";
+    // each step's cells as framesPrefix000000123.png, the cells after 123 steps,
+    // read back without stalling
+    std::string framesPrefix = "";
+    unsigned frameWorkers = 1;
 
     if (argv >= 3)
     {
@@ -26,6 +50,74 @@ int main(int argv, char ** argc)
         {
             durationSeconds = std::stoi(args["-durationSeconds"]);
         }
+        if (args.find("-seed") != args.end())
+        {
+            seed = std::stoull(args["-seed"]);
+        }
+        if (args.find("-headless") != args.end())
+        {
+            headless = std::stoi(args["-headless"]) != 0;
+        }
+        if (args.find("-benchmark") != args.end())
+        {
+            benchmark = std::stoi(args["-benchmark"]) != 0;
+            // the same scenario every run unless a seed is given
+            if (args.find("-seed") == args.end()) { seed = 0; }
+        }
+        if (args.find("-steps") != args.end())
+        {
+            maxSteps = std::stoull(args["-steps"]);
+        }
+        if (args.find("-benchmarkFormat") != args.end())
+        {
+            benchmarkFormat = args["-benchmarkFormat"];
+        }
+        if (args.find("-trace") != args.end())
+        {
+            tracePath = args["-trace"];
+        }
+        if (args.find("-timing") != args.end())
+        {
+            timing = std::stoi(args["-timing"]) != 0;
+        }
+        if (args.find("-load") != args.end())
+        {
+            loadPath = args["-load"];
+        }
+        if (args.find("-save") != args.end())
+        {
+            savePath = args["-save"];
+        }
+        if (args.find("-record") != args.end())
+        {
+            recordPath = args["-record"];
+        }
+        if (args.find("-replay") != args.end())
+        {
+            replayPath = args["-replay"];
+        }
+        if (args.find("-frames") != args.end())
+        {
+            framesPrefix = args["-frames"];
+        }
+        if (args.find("-frameWorkers") != args.end())
+        {
+            frameWorkers = std::stoi(args["-frameWorkers"]);
+        }
+        if (args.find("-fused") != args.end())
+        {
+            fused = std::stoi(args["-fused"]) != 0;
+        }
+    }
+
+    const bool recording = recordPath != "";
+    const bool replaying = replayPath != "";
+    Journal replay;
+    size_t nextEvent = 0;
+    if (replaying)
+    {
+        replay = Journal::load(replayPath);
+        seed = replay.getSeed();
     }
 
     jGL::DesktopDisplay::Config conf;
@@ -35,8 +127,16 @@ int main(int argv, char ** argc)
     #ifdef MACOS
     conf.COCOA_RETINA = true;
     #endif
-    jGL::DesktopDisplay display(glm::ivec2(resX, resY), "GPGPU Sand", conf);
-    display.setFrameLimit(60);
+    Window display(glm::ivec2(resX, resY), "GPGPU Sand", conf, headless);
+    if (benchmark || replaying)
+    {
+        display.setVsync(false);
+    }
+    else
+    {
+        display.setFrameLimit(60);
+    }
+    if (headless) { std::cout << "Headless, " << display.getBackend() << "\n"; }
 
     glewInit();
 
@@ -54,8 +154,6 @@ int main(int argv, char ** argc)
     jGLInstance->setTextProjection(glm::ortho(0.0,double(resX),0.0,double(resY)));
     jGLInstance->setMSAA(16);
 
-    RNG rng;
-
     std::shared_ptr<jGL::Shader> shader = std::make_shared<jGL::GL::glShader>
     (
         jGL::GL::glShapeRenderer::shapeVertexShader,
@@ -71,104 +169,229 @@ int main(int argv, char ** argc)
     int n = cells*cells;
     int m = cells/2;
 
-    std::vector<float> noise(m*m, 0.0);
-    std::vector<float> spawnNoise(m*m, 0.0);
     std::vector<float> states(n, 0.0);
-    std::vector<float> margolus(m*m, 0.0);
     std::vector<float> obstacles(n, 0.0);
     std::vector<float> density(n, 0.0);
 
-    for (int i = 0; i < m*m; i++)
+    // the MargolusEngine defaults, with a trickle of sand from the top
+    MargolusEngine::Parameters parameters;
+    parameters.spawnProb = 0.0000001f;
+    // counter based random numbers, shared with MargolusEngine
+    uint64_t steps = 0;
+    int type = 0;
+
+    if (loadPath != "")
     {
-        noise[i] = rng.nextFloat();
-        spawnNoise[i] = rng.nextFloat();
+        Checkpoint loaded = loadCheckpoint(loadPath, std::thread::hardware_concurrency());
+        if (loaded.width != uint64_t(cells) || loaded.height != uint64_t(cells))
+        {
+            throw std::runtime_error("Checkpoint "+loadPath+" is not "+std::to_string(cells)+" cells square");
+        }
+        for (int j = 0; j < cells; j++)
+        {
+            for (int i = 0; i < cells; i++)
+            {
+                states[j*cells+i] = loaded.planes[0].get(i, j);
+                if (loaded.planes.size() > 1) { obstacles[j*cells+i] = loaded.planes[1].get(i, j); }
+            }
+        }
+        parameters = loaded.parameters;
+        seed = loaded.seed;
+        steps = loaded.steps;
+        type = loaded.type;
     }
-
-    for (int i = 0; i < n; i++)
+    else if (benchmark)
     {
-        //states[i] = rng.nextFloat()<0.1;
+        std::mt19937 fill(seed);
+        std::uniform_real_distribution<float> U;
+        for (int i = 0; i < n; i++)
+        {
+            states[i] = U(fill) < 0.1f;
+        }
     }
 
-    glCompute update
+    // painted obstacles, the only attribute with a host copy, held apart
+    // from the passes so either way of stepping can draw them
+    glCompute walls
     (
         {
-            {"cells", {cells, cells, 1}},
-            {"noise", {m, m, 1}},
-            {"margolus", {m, m, 1}},
             {"obstacles", {cells, cells, 1}}
         },
-        {m, m, 1},
-        1,
-        blockCAComputeShader
+        {cells, cells, 1},
+        0,
+        holdShader
     );
+    walls.set("obstacles", obstacles);
+    walls.sync();
+
+    /*
+        The fused step, or the original passes and their intermediate
+        textures, only the one in use. Each original pass renders straight
+        into the next one's input, the cells of toMargolus, the margolus of
+        blockCA and the margolus of fromMargolus, so stepping copies
+        nothing.
+    */
+    std::unique_ptr<glCompute> step, update, toMargolus, fromMargolus;
+    if (!fused)
+    {
+        update = std::make_unique<glCompute>
+        (
+            std::map<std::string, glCompute::AttributeDimension>
+            {
+                {"margolus", {m, m, 1, -1, TextureFormat::FLOAT, true}}
+            },
+            glCompute::AttributeDimension {m, m, 1, -1, TextureFormat::FLOAT, true},
+            1,
+            blockCAComputeShader
+        );
+
+        toMargolus = std::make_unique<glCompute>
+        (
+            std::map<std::string, glCompute::AttributeDimension>
+            {
+                {"cells", {cells, cells, 1, -1, TextureFormat::FLOAT, true}}
+            },
+            glCompute::AttributeDimension {m, m, 1, -1, TextureFormat::FLOAT, true},
+            1,
+            toMargolusShader
+        );
+
+        fromMargolus = std::make_unique<glCompute>
+        (
+            std::map<std::string, glCompute::AttributeDimension>
+            {
+                {"margolus", {m, m, 1, -1, TextureFormat::FLOAT, true}}
+            },
+            glCompute::AttributeDimension {cells, cells, 1, -1, TextureFormat::FLOAT, true},
+            1,
+            fromMargolusShader
+        );
+
+        toMargolus->renderInto(0, update->getTexture("margolus"));
+        update->renderInto(0, fromMargolus->getTexture("margolus"));
+        fromMargolus->renderInto(0, toMargolus->getTexture("cells"));
+
+        toMargolus->set("cells", states);
+
+        toMargolus->shader.setUniform("width", cells);
+        toMargolus->shader.setUniform("spawnProb", parameters.spawnProb);
+        fromMargolus->shader.setUniform("width", cells);
+    }
+    else
+    {
+        step = std::make_unique<glCompute>
+        (
+            std::map<std::string, glCompute::AttributeDimension>
+            {
+                {"cells", {cells, cells, 1, 0, TextureFormat::R8UI, true}}
+            },
+            glCompute::AttributeDimension {cells, cells, 1, -1, TextureFormat::R8UI, true},
+            1,
+            margolusStepShader
+        );
+
+        step->set("cells", std::vector<uint8_t>(states.begin(), states.end()));
+        step->shader.setUniform("width", cells);
+        step->shader.setUniform("spawnProb", parameters.spawnProb);
+    }
 
-    glCompute toMargolus
-    (
-        {
-            {"cells", {cells, cells, 1}},
-            {"noise", {cells, cells, 1}}
-        },
-        {m, m, 1},
-        1,
-        toMargolusShader
-    );
+    // the shaders of whichever passes step the cells, by the uniforms they take
+    std::vector<jGL::Shader*> rules, randoms, phases;
+    if (fused)
+    {
+        rules = randoms = phases = {&step->shader};
+    }
+    else
+    {
+        rules = {&update->shader};
+        randoms = {&toMargolus->shader, &update->shader};
+        phases = {&toMargolus->shader, &fromMargolus->shader};
+    }
 
-    glCompute fromMargolus
-    (
-        {
-            {"margolus", {m, m, 1}}
-        },
-        {cells, cells, 1},
-        1,
-        fromMargolusShader
-    );
+    for (jGL::Shader * s : rules)
+    {
+        s->setUniform("p1", parameters.p1);
+        s->setUniform("p2", parameters.p2);
+        s->setUniform("p31", parameters.p31);
+        s->setUniform("p32", parameters.p32);
+        s->setUniform("p6", parameters.p6);
+        s->setUniform("p7", parameters.p7);
+        s->setUniform("p9", parameters.p9);
+        s->setUniform("p11", parameters.p11);
+    }
+
+    for (jGL::Shader * s : randoms)
+    {
+        s->setUniform("seedLo", int(uint32_t(seed)));
+        s->setUniform("seedHi", int(uint32_t(seed >> 32)));
+    }
 
-    update.set("noise", noise);
-    update.set("margolus", margolus);
-    update.set("cells", states);
-    update.set("obstacles", obstacles);
-    update.sync();
-
-    float pswap = 0.1;
-    float pfriction = 0.1;
-    float pslide = 0.9;
-    update.shader.setUniform("p1", pswap);
-    update.shader.setUniform("p2", pswap);
-    update.shader.setUniform("p31", pfriction);
-    update.shader.setUniform("p32", pswap);
-    update.shader.setUniform("p6", pslide);
-    update.shader.setUniform("p7", pfriction);
-    update.shader.setUniform("p9", pslide);
-    update.shader.setUniform("p11", pfriction);
-
-    toMargolus.set("cells", states);
-    toMargolus.set("noise", spawnNoise);
-    toMargolus.sync();
-    toMargolus.shader.setUniform("width", cells);
-    toMargolus.shader.setUniform("type", 0);
-    toMargolus.shader.setUniform("spawnProb", 0.0000001f);
-
-    fromMargolus.set("margolus", margolus);
-    fromMargolus.sync();
-    fromMargolus.shader.setUniform("width", cells);
-    fromMargolus.shader.setUniform("type", 0);
+    // uploaded, the textures hold the only copy from here
+    std::vector<float>().swap(states);
+    std::vector<float>().swap(obstacles);
+    std::vector<float>().swap(density);
 
     float scale = cells/resX;
 
-    Visualise vis(update.getTexture("cells"), update.getTexture("obstacles"));
+    Visualise vis(fused ? step->getTexture("cells") : toMargolus->getTexture("cells"), walls.getTexture("obstacles"), fused);
     glEnable(GL_PROGRAM_POINT_SIZE);
     glEnable(GL_POINT_SPRITE);
 
+    PassTimer timer;
+    PassTimer * passTimer = timing ? &timer : nullptr;
+    if (fused) { step->setTimer(passTimer, "step"); }
+    else
+    {
+        update->setTimer(passTimer, "blockCA");
+        toMargolus->setTimer(passTimer, "toMargolus");
+        fromMargolus->setTimer(passTimer, "fromMargolus");
+    }
+
+    // particle count sampled without stalling, arriving a few frames late
+    uint64_t particles = 0;
+    if (fused) { step->setPackBuffers(3); }
+
+    // frames dropped, never waited for, when readbacks or encoding fall behind
+    std::unique_ptr<FrameRecorder> frames;
+    if (framesPrefix != "")
+    {
+        frames = std::make_unique<FrameRecorder>(framesPrefix, frameWorkers);
+        (fused ? *step : *toMargolus).setPackBuffers(8);
+    }
+
     bool placeing = false; bool removing = false;
     bool reset = false;
-    int type = 0;
-    paused = true;
+    paused = !(headless || benchmark || replaying);
+    // the seed is final once any checkpoint is loaded
+    Journal journal(seed);
+    // a loaded checkpoint's steps were not taken in this run
+    const uint64_t startSteps = steps;
+    BenchmarkResult result {fused ? "fused" : "passes", uint64_t(n), 0, 0.0, {}};
+    // step times from GL_TIME_ELAPSED queries, so steps are never waited on
+    if (benchmark) { timer.keepSamples("benchmark.step", &result.stepSeconds); }
 
     auto start = std::chrono::steady_clock::now();
 
+    if (tracePath != "")
+    {
+        Trace::enable();
+        Trace::setThreadName("main");
+    }
+
     while (display.isOpen())
     {
         tic = high_resolution_clock::now();
+        Trace::Scope frameTrace("frame");
+
+        if
+        (
+            ((headless || benchmark) && !replaying && std::chrono::steady_clock::now()-start > std::chrono::seconds(durationSeconds)) ||
+            (benchmark && maxSteps > 0 && steps-startSteps >= maxSteps) ||
+            (replaying && nextEvent == replay.getEvents().size() && steps >= replay.endStep())
+        )
+        {
+            break;
+        }
 
         if (display.keyHasEvent(GLFW_KEY_DOWN, jGL::EventType::PRESS))
         {
@@ -179,14 +402,21 @@ int main(int argv, char ** argc)
             camera.incrementZoom(1.0f);
         }
 
-        if (display.keyHasEvent(GLFW_KEY_SPACE, jGL::EventType::PRESS))
+        if (!replaying && display.keyHasEvent(GLFW_KEY_SPACE, jGL::EventType::PRESS))
         {
             paused = !paused;
+            if (recording) { journal.pause(steps); }
+        }
+
+        if (tracePath != "" && display.keyHasEvent(GLFW_KEY_T, jGL::EventType::PRESS))
+        {
+            Trace::write(tracePath);
         }
 
-        if (display.keyHasEvent(GLFW_KEY_R, jGL::EventType::PRESS))
+        if (!replaying && display.keyHasEvent(GLFW_KEY_R, jGL::EventType::PRESS))
         {
             reset = true;
+            if (recording) { journal.reset(steps); }
         }
 
         if (display.keyHasEvent(GLFW_MOUSE_BUTTON_LEFT, jGL::EventType::PRESS) || display.keyHasEvent(GLFW_MOUSE_BUTTON_LEFT, jGL::EventType::HOLD))
@@ -209,63 +439,96 @@ int main(int argv, char ** argc)
             removing = false;
         }
 
-        if (placeing || removing)
+        if (!replaying && (placeing || removing))
         {
             double mouseX, mouseY;
             display.mousePosition(mouseX,mouseY);
             float value = 0.0;
             if (placeing) { value = 1.0; }
             if (removing) { value = 0.0; }
-            placeOrRemove(obstacles, int(mouseX), int(resY-mouseY), 16, resX, value);
-            update.set("obstacles", obstacles);
-            update.sync("obstacles");
+            // in cells, as the obstacles are painted and journaled
+            const int brush = std::max(1, 16*cells/resX);
+            const int i = int(mouseX*cells/resX);
+            const int j = int((resY-mouseY)*cells/resY);
+            placeOrRemove(walls, "obstacles", i, j, brush, cells, value);
+            if (recording) { journal.brush(steps, i-brush, j-brush, i+brush, j+brush, value); }
         }
 
-        if (!paused)
+        // events recorded before this step, applied as they were; pauses
+        // change nothing but when steps happen, so are skipped
+        while (replaying && nextEvent < replay.getEvents().size() && replay.getEvents()[nextEvent].step <= steps)
         {
-            if (reset) { update.shader.setUniform("reset", 1.0f); }
+            const Journal::Event & e = replay.getEvents()[nextEvent++];
+            if (e.type == Journal::Type::BRUSH)
+            {
+                paint(walls, "obstacles", e.x0, e.y0, e.x1, e.y1, cells, e.value);
+            }
+            else if (e.type == Journal::Type::RESET)
+            {
+                reset = true;
+            }
+        }
+        // strokes this frame merged into one rectangle
+        walls.sync("obstacles");
 
-            toMargolus.shader.setUniform("type", type);
-            toMargolus.shader.setUniform("seed", rng.nextFloat());
-            fromMargolus.shader.setUniform("type", type);
+        if (!paused)
+        {
+            Trace::Scope stepTrace("step");
+            if (reset && !fused) { update->shader.setUniform("reset", 1.0f); }
+
+            for (jGL::Shader * s : randoms)
+            {
+                s->setUniform("stepLo", int(uint32_t(steps)));
+                s->setUniform("stepHi", int(uint32_t(steps >> 32)));
+            }
+            for (jGL::Shader * s : phases) { s->setUniform("type", type); }
             type = 1-type;
 
-            toMargolus.glCopyTexture
-            (
-                update.getTexture("cells"),
-                toMargolus.getTexture("cells"),
-                {cells, cells}
-            );
-            toMargolus.compute(false);
-            toMargolus.glCopyTexture
-            (
-                toMargolus.outputTexture(0),
-                update.getTexture("margolus"),
-                {m, m}
-            );
-
-            update.shader.setUniform("seed", glm::vec2(rng.nextFloat(), rng.nextFloat()));
-            update.compute(false);
-            update.glCopyTexture
-            (
-                update.outputTexture(0),
-                fromMargolus.getTexture("margolus"),
-                {m, m}
-            );
-
-            fromMargolus.compute(false);
-            fromMargolus.glCopyTexture
-            (
-                fromMargolus.outputTexture(0),
-                update.getTexture("cells"),
-                {cells, cells}
-            );
-
-            if (reset) { update.shader.setUniform("reset", 0.0f); reset = false; }
+            // the cells before this step, named by the steps taken so far as
+            // in the headless driver, read back ahead of the step
+            if (frames)
+            {
+                const uint64_t frameStep = steps;
+                auto record = [&frames, frameStep](auto values)
+                {
+                    BitGrid grid(cells, cells);
+                    for (int j = 0; j < cells; j++)
+                    {
+                        for (int i = 0; i < cells; i++) { grid.set(i, j, values[j*cells+i] > 0); }
+                    }
+                    frames->push(frameStep, std::move(grid));
+                };
+                if (fused) { step->readAsync<uint8_t>("cells", record); }
+                else { toMargolus->readAsync<float>("cells", record); }
+            }
+
+            // the whole step on the GPU, not its readback, so the passes
+            // inside are timed on the CPU only
+            PassTimer::Scope benchmarkScope(benchmark ? &timer : nullptr, "benchmark.step");
+            if (fused)
+            {
+                // renders into the back buffer of cells then swaps
+                step->compute(false);
+                vis.particlesTexture = step->getTexture("cells");
+            }
+            else
+            {
+                toMargolus->compute(false);
+                update->compute(false);
+                fromMargolus->compute(false);
+            }
+
+            if (reset && !fused) { update->shader.setUniform("reset", 0.0f); }
+            reset = false;
+            steps++;
         }
         glClearColor(0.0,0.0,0.0,1.0);
         glClear(GL_COLOR_BUFFER_BIT);
-        vis.drawParticles(n, scale, camera.getVP());
+        {
+            PassTimer::Scope scope(passTimer, "drawParticles");
+            Trace::Scope trace("drawParticles");
+            vis.drawParticles(n, scale, camera.getVP());
+        }
         //vis.drawObstacles(obstacles.size(), scale, camera.getVP());
 
         delta = 0.0;
@@ -275,12 +538,35 @@ int main(int argv, char ** argc)
         }
         delta /= 60.0;
 
-        if (frameId == 59)
+        if (fused && frameId == 0)
+        {
+            step->readAsync<uint8_t>
+            (
+                "cells",
+                [&particles](gsl::span<const uint8_t> cells)
+                {
+                    particles = std::count(cells.begin(), cells.end(), uint8_t(1));
+                }
+            );
+        }
+        if (fused) { step->pollReadbacks(); }
+        else if (frames) { toMargolus->pollReadbacks(); }
+
+        if (frameId == 59 && !benchmark)
         {
-            std::cout << "FPS: " << fixedLengthNumber(1.0/delta,4) << "\n";
+            std::cout << "FPS: " << fixedLengthNumber(1.0/delta,4);
+            if (fused) { std::cout << ", particles: " << particles; }
+            std::cout << "\n";
+            if (timing) { std::cout << timer.report(); }
         }
 
-        display.loop();
+        {
+            // includes the frame limit's sleep and the buffer swap
+            PassTimer::Scope scope(passTimer, "display.loop", false);
+            Trace::Scope trace("display.loop");
+            display.loop();
+        }
+        if (timing || benchmark) { timer.frame(); }
 
         tock = high_resolution_clock::now();
 
@@ -290,6 +576,63 @@ int main(int argv, char ** argc)
 
     }
 
+    if (benchmark)
+    {
+        // the steps still in flight count toward the run's time, and both
+        // sets of queries are read once they have finished
+        glFinish();
+        result.steps = steps-startSteps;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        timer.frame();
+        timer.frame();
+        std::cout << (benchmarkFormat == "csv" ? result.csv() : result.json()) << "\n";
+    }
+
+    if (frames)
+    {
+        (fused ? *step : *toMargolus).pollReadbacks(true);
+        frames->finish();
+        std::cout << "Frames written: " << frames->getWritten() << ", skipped: " << frames->getSkipped() << "\n";
+    }
+
+    if (recording)
+    {
+        journal.end(steps);
+        journal.save(recordPath);
+        std::cout << "Recorded " << journal.getEvents().size() << " events over " << steps << " steps\n";
+    }
+
+    if (savePath != "")
+    {
+        Checkpoint saved;
+        saved.width = cells;
+        saved.height = cells;
+        saved.type = type;
+        saved.seed = seed;
+        saved.steps = steps;
+        saved.parameters = parameters;
+        saved.planes.assign(2, BitGrid(cells, cells));
+        const std::vector<float> obstacleValues = walls.get("obstacles");
+        std::vector<uint8_t> cellValues;
+        if (fused) { cellValues = step->getAs<uint8_t>("cells"); }
+        else
+        {
+            const std::vector<float> values = toMargolus->get("cells");
+            cellValues.assign(values.begin(), values.end());
+        }
+        for (int j = 0; j < cells; j++)
+        {
+            for (int i = 0; i < cells; i++)
+            {
+                saved.planes[0].set(i, j, cellValues[j*cells+i] > 0);
+                saved.planes[1].set(i, j, obstacleValues[j*cells+i] > 0.0f);
+            }
+        }
+        saveCheckpoint(savePath, saved, std::thread::hardware_concurrency());
+    }
+
+    if (tracePath != "") { Trace::write(tracePath); }
+
     jGLInstance->finish();
 
     return 0;
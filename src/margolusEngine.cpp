@@ -0,0 +1,438 @@
+#include <margolusEngine.h>
+#include <snapshot.h>
+#include <trace.h>
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // probability as a whole number of 1/256ths
+    inline float quantise(float p)
+    {
+        return std::min(std::max(std::floor(p*256.0f+0.5f), 0.0f), 256.0f)/256.0f;
+    }
+}
+
+MargolusEngine::MargolusEngine
+(
+    uint64_t width,
+    uint64_t height,
+    Parameters parameters,
+    uint64_t seed
+)
+: width(width), height(height), parameters(parameters), type(0), steps(0),
+  seed(seed), tracking(true)
+{
+    if (height < 2 || height % 2 != 0)
+    {
+        throw std::runtime_error("Margolus grid dimensions must be even");
+    }
+    cells = BitGrid(width, height);
+    tilesX = width/TILE;
+    tilesY = (height+TILE-1)/TILE;
+    ttl.assign(tilesX*tilesY, 2);
+    flags.assign(tilesX*tilesY, 0);
+    modified.assign(tilesX*tilesY, 0);
+    lastModified = 0;
+    setKernel(bestKernel());
+    setThreads(1);
+    updateTables();
+}
+
+MargolusEngine::~MargolusEngine()
+{
+    detachSnapshot();
+}
+
+uint8_t MargolusEngine::rule
+(
+    uint8_t hash,
+    bool wallx,
+    bool wally,
+    float d,
+    const Parameters & p
+)
+{
+    switch (hash)
+    {
+        case 1:
+            if (wally) { return 1; }
+            return (!wallx && d < p.p1) ? 4 : 8;
+        case 2:
+            if (wally) { return 2; }
+            return d < p.p2 ? 8 : 4;
+        case 3:
+            if (wally) { return 3; }
+            if (d < p.p31) { return 3; }
+            return d < p.p32 ? 10 : 5;
+        case 5:
+            return 12;
+        case 6:
+            return d < p.p6 ? 12 : 6;
+        case 7:
+            return d < p.p7 ? 7 : 14;
+        case 9:
+            if (wallx) { return 9; }
+            return d < p.p9 ? 12 : 9;
+        case 10:
+            return 12;
+        case 11:
+            return d < p.p11 ? 11 : 13;
+        default:
+            return hash;
+    }
+}
+
+void MargolusEngine::place(int i, int j, int brush, uint8_t value)
+{
+    for (int n = -brush; n <= brush; n++)
+    {
+        for (int m = -brush; m <= brush; m++)
+        {
+            int ix = (n+i) % int(width);
+            int iy = (m+j) % int(height);
+            if (ix < 0) { ix += width; }
+            if (iy < 0) { iy += height; }
+            set(ix, iy, value);
+        }
+    }
+}
+
+void MargolusEngine::restore(const BitGrid & state, int type, uint64_t steps)
+{
+    if (state.getWidth() != width || state.getHeight() != height)
+    {
+        throw std::runtime_error("Restored state does not match the grid size");
+    }
+    detachSnapshot();
+    cells = state;
+    this->type = type & 1;
+    this->steps = steps;
+    wakeAll();
+    std::fill(modified.begin(), modified.end(), steps);
+    lastModified = steps;
+}
+
+std::shared_ptr<Snapshot> MargolusEngine::takeSnapshot()
+{
+    detachSnapshot();
+    snapshot = std::make_shared<Snapshot>(*this);
+    return snapshot;
+}
+
+void MargolusEngine::preserve(uint64_t tx, uint64_t ty)
+{
+    snapshot->preserve(tx, ty);
+}
+
+void MargolusEngine::preserveBand(const Band & band)
+{
+    // a tile's blocks write its own cells, and in the odd phase the first
+    // column and row of the tiles right and below
+    for (uint64_t ty = band.begin/(TILE/2); ty*(TILE/2) < band.end; ty++)
+    {
+        for (uint64_t tx = 0; tx < tilesX; tx++)
+        {
+            if (!ttl[ty*tilesX+tx]) { continue; }
+            const uint64_t right = (tx+1) % tilesX;
+            const uint64_t below = (ty+1) % tilesY;
+            snapshot->preserve(tx, ty);
+            snapshot->preserve(right, ty);
+            snapshot->preserve(tx, below);
+            snapshot->preserve(right, below);
+        }
+    }
+}
+
+void MargolusEngine::detachSnapshot()
+{
+    if (!snapshot) { return; }
+    snapshot->preserveAll();
+    snapshot.reset();
+}
+
+void MargolusEngine::setThreads(unsigned n)
+{
+    n = std::max(1u, unsigned(std::min(uint64_t(n), tilesY)));
+    const uint64_t rows = height/2;
+    const uint64_t words = cells.getWordsPerRow();
+
+    pool.reset();
+    bands.resize(n);
+    for (unsigned b = 0; b < n; b++)
+    {
+        Band & band = bands[b];
+        band.begin = std::min(((b*tilesY)/n)*TILE/2, rows);
+        band.end = std::min((((b+1)*tilesY)/n)*TILE/2, rows);
+        band.random.resize(32*words);
+        band.top.resize(words);
+        band.bottom.resize(words);
+        band.oldTop.resize(words);
+        band.oldBottom.resize(words);
+    }
+
+    if (n > 1)
+    {
+        // the stepping thread works on a band too
+        pool = std::make_unique<jThread::ThreadPool>(n-1);
+    }
+}
+
+uint64_t MargolusEngine::getActiveTiles() const
+{
+    return std::count_if(ttl.begin(), ttl.end(), [](uint8_t t) { return t > 0; });
+}
+
+void MargolusEngine::wake(uint64_t tx, uint64_t ty)
+{
+    // a cell is in blocks of its own tile and those up and to the left,
+    // and a change to it can free blocks of any neighbour
+    for (uint64_t n = tilesY-1; n <= tilesY+1; n++)
+    {
+        for (uint64_t m = tilesX-1; m <= tilesX+1; m++)
+        {
+            ttl[((ty+n) % tilesY)*tilesX+(tx+m) % tilesX] = 2;
+        }
+    }
+}
+
+void MargolusEngine::spawn()
+{
+    if (parameters.spawnProb <= 0.0f) { return; }
+    for (uint64_t i = 0; i < width; i++)
+    {
+        if (spawnRandom(seed, steps, i) < parameters.spawnProb) { set(i, 0, 1); }
+    }
+}
+
+void MargolusEngine::updateTables()
+{
+    Parameters q = parameters;
+    q.p1 = quantise(q.p1); q.p2 = quantise(q.p2); q.p31 = quantise(q.p31); q.p32 = quantise(q.p32);
+    q.p6 = quantise(q.p6); q.p7 = quantise(q.p7); q.p9 = quantise(q.p9); q.p11 = quantise(q.p11);
+
+    for (uint8_t wy = 0; wy < 2; wy++)
+    {
+        for (uint8_t wx = 0; wx < 2; wx++)
+        {
+            BlockTables & t = tables[wy][wx];
+            for (uint8_t h = 0; h < 16; h++)
+            {
+                // the outcome over d = 0..255 is at most 3 runs, as in rule()
+                uint8_t out[256];
+                uint16_t changes[2] = {0, 0};
+                uint8_t runs = 1;
+                for (uint16_t d = 0; d < 256; d++)
+                {
+                    out[d] = rule(h, wx, wy, (d+0.5f)/256.0f, q);
+                    if (d > 0 && out[d] != out[d-1])
+                    {
+                        if (runs == 3) { throw std::runtime_error("Block rule has more than 3 outcomes"); }
+                        changes[runs-1] = d;
+                        runs++;
+                    }
+                }
+                t.first[h] = changes[0];
+                t.second[h] = changes[1];
+                t.a[h] = out[0];
+                t.b[h] = out[changes[0]];
+                t.c[h] = out[runs == 3 ? changes[1] : changes[0]];
+            }
+            mobile[wy][wx] = t.mobile();
+        }
+    }
+}
+
+void MargolusEngine::stepRun(uint64_t bj, uint64_t k0, uint64_t k1, Band & band)
+{
+    const uint64_t n = cells.getWordsPerRow();
+    const uint64_t y0 = 2*bj+type;
+    uint64_t * top = cells.row(y0);
+    uint64_t * bottom = cells.row((y0+1) % height);
+    const bool wally = bj == height/2-1;
+    const bool wallx = k1 == n;
+    const uint64_t m = k1-k0;
+
+    uint64_t * T = band.top.data();
+    uint64_t * B = band.bottom.data();
+
+    // with the odd offset blocks start at x = 1, so step rows shifted
+    // down one bit
+    for (uint64_t k = k0; k < k1; k++)
+    {
+        if (type == 1)
+        {
+            T[k-k0] = (top[k] >> 1) | (top[(k+1) % n] << 63);
+            B[k-k0] = (bottom[k] >> 1) | (bottom[(k+1) % n] << 63);
+        }
+        else
+        {
+            T[k-k0] = top[k];
+            B[k-k0] = bottom[k];
+        }
+    }
+    std::memcpy(band.oldTop.data(), T, m*sizeof(uint64_t));
+    std::memcpy(band.oldBottom.data(), B, m*sizeof(uint64_t));
+
+    // block bx = 32k+b of word k takes byte b of the word's 32
+    uint8_t * random = band.random.data();
+    for (uint64_t x = 2*k0; x < 2*k1; x++)
+    {
+        uint32_t r[4];
+        blockRandom16(seed, steps, x, bj, r);
+        std::memcpy(&random[16*(x-2*k0)], r, 16);
+    }
+
+    // the last block in the row is against the wall, patch it afterwards
+    const uint8_t last = ((T[m-1] >> 62) & 3) | (((B[m-1] >> 62) & 3) << 2);
+
+    kernel(T, B, m, random, tables[wally][0]);
+
+    if (wallx)
+    {
+        const uint64_t next = tables[wally][1].apply(last, random[32*m-1]);
+        T[m-1] = (T[m-1] & ~(uint64_t(3) << 62)) | ((next & 3) << 62);
+        B[m-1] = (B[m-1] & ~(uint64_t(3) << 62)) | (((next >> 2) & 3) << 62);
+    }
+
+    for (uint64_t k = k0; k < k1; k++)
+    {
+        if (type == 1)
+        {
+            const uint64_t k2 = (k+1) % n;
+            top[k] = (top[k] & 1) | (T[k-k0] << 1);
+            bottom[k] = (bottom[k] & 1) | (B[k-k0] << 1);
+            top[k2] = (top[k2] & ~uint64_t(1)) | (T[k-k0] >> 63);
+            bottom[k2] = (bottom[k2] & ~uint64_t(1)) | (B[k-k0] >> 63);
+        }
+        else
+        {
+            top[k] = T[k-k0];
+            bottom[k] = B[k-k0];
+        }
+    }
+
+    // word k is the blocks of tile column k in this block row
+    uint8_t * tileFlags = &flags[(bj/(TILE/2))*tilesX];
+    for (uint64_t k = k0; k < k1; k++)
+    {
+        const uint64_t oldT = band.oldTop[k-k0];
+        const uint64_t oldB = band.oldBottom[k-k0];
+        if ((T[k-k0] ^ oldT) | (B[k-k0] ^ oldB))
+        {
+            tileFlags[k] |= CHANGED;
+        }
+        else if (!tileFlags[k])
+        {
+            uint64_t free = blocksIn(oldT, oldB, mobile[wally][0]);
+            if (k == n-1)
+            {
+                free &= ~(uint64_t(1) << 62);
+                if ((mobile[wally][1] >> last) & 1) { free = 1; }
+            }
+            if (free) { tileFlags[k] |= MOBILE; }
+        }
+    }
+}
+
+void MargolusEngine::stepBlockRow(uint64_t bj, Band & band)
+{
+    const uint64_t n = cells.getWordsPerRow();
+    const uint8_t * active = &ttl[(bj/(TILE/2))*tilesX];
+
+    uint64_t k = 0;
+    while (k < n)
+    {
+        if (!active[k]) { k++; continue; }
+        const uint64_t k0 = k;
+        while (k < n && active[k]) { k++; }
+        stepRun(bj, k0, k, band);
+    }
+}
+
+void MargolusEngine::stepBand(Band & band)
+{
+    Trace::Scope scope("stepBand");
+    if (snapshot) { preserveBand(band); }
+    for (uint64_t bj = band.begin; bj < band.end; bj++)
+    {
+        // skip whole tile rows at rest
+        if (bj % (TILE/2) == 0)
+        {
+            const uint8_t * active = &ttl[(bj/(TILE/2))*tilesX];
+            if (std::none_of(active, active+tilesX, [](uint8_t t) { return t > 0; }))
+            {
+                bj += TILE/2-1;
+                continue;
+            }
+        }
+        stepBlockRow(bj, band);
+    }
+}
+
+void MargolusEngine::updateTiles()
+{
+    Trace::Scope scope("updateTiles");
+    // a tile's changes can reach the first column and row of the tiles
+    // right and below, in the odd phase
+    for (uint64_t ty = 0; ty < tilesY; ty++)
+    {
+        for (uint64_t tx = 0; tx < tilesX; tx++)
+        {
+            if (!(flags[ty*tilesX+tx] & CHANGED)) { continue; }
+            const uint64_t right = (tx+1) % tilesX;
+            const uint64_t below = ((ty+1) % tilesY)*tilesX;
+            modified[ty*tilesX+tx] = steps;
+            modified[ty*tilesX+right] = steps;
+            modified[below+tx] = steps;
+            modified[below+right] = steps;
+            lastModified = steps;
+        }
+    }
+
+    if (!tracking)
+    {
+        wakeAll();
+        std::fill(flags.begin(), flags.end(), 0);
+        return;
+    }
+
+    for (uint8_t & t : ttl)
+    {
+        if (t > 0) { t--; }
+    }
+    for (uint64_t ty = 0; ty < tilesY; ty++)
+    {
+        for (uint64_t tx = 0; tx < tilesX; tx++)
+        {
+            uint8_t & f = flags[ty*tilesX+tx];
+            if (f & CHANGED) { wake(tx, ty); }
+            else if (f & MOBILE) { ttl[ty*tilesX+tx] = 2; }
+            f = 0;
+        }
+    }
+}
+
+void MargolusEngine::step()
+{
+    Trace::Scope scope("MargolusEngine::step");
+    spawn();
+
+    // blocks of one phase never share cells, so bands need no locking
+    if (pool)
+    {
+        pool->parallel_for(0, bands.size(), 1, [this](size_t b) { stepBand(bands[b]); });
+    }
+    else
+    {
+        stepBand(bands[0]);
+    }
+
+    updateTiles();
+
+    type = 1-type;
+    steps++;
+
+    if (snapshot && snapshot->detached()) { snapshot.reset(); }
+}
@@ -0,0 +1,132 @@
+#include <recording.h>
+#include <frameRecorder.h>
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+/*
+
+    Scrubs a recording made with particles-headless -record.
+
+        -recording path     the recording
+        -step n             frame at or before step n, default the last
+        -png path           that frame as a PNG
+        -frames prefix      frames from -from to -to, one per -every steps,
+                            as a PNG sequence prefix000000123.png
+
+*/
+
+int main(int argv, char ** argc)
+{
+
+    std::string recordingPath = "";
+    std::string pngPath = "";
+    std::string framesPrefix = "";
+    bool seekStep = false;
+    uint64_t target = 0;
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    uint64_t every = 1;
+
+    if (argv >= 3)
+    {
+        std::map<std::string, std::string> args;
+        std::vector<std::string> inputs;
+        for (int i = 1; i < argv; i++)
+        {
+            inputs.push_back(argc[i]);
+        }
+        std::reverse(inputs.begin(), inputs.end());
+        while (inputs.size() >= 2)
+        {
+            std::string arg = inputs.back();
+            inputs.pop_back();
+            args[arg] = inputs.back();
+            inputs.pop_back();
+        }
+
+        if (args.find("-recording") != args.end())
+        {
+            recordingPath = args["-recording"];
+        }
+        if (args.find("-step") != args.end())
+        {
+            seekStep = true;
+            target = std::stoull(args["-step"]);
+        }
+        if (args.find("-png") != args.end())
+        {
+            pngPath = args["-png"];
+        }
+        if (args.find("-frames") != args.end())
+        {
+            framesPrefix = args["-frames"];
+        }
+        if (args.find("-from") != args.end())
+        {
+            from = std::stoull(args["-from"]);
+        }
+        if (args.find("-to") != args.end())
+        {
+            to = std::stoull(args["-to"]);
+        }
+        if (args.find("-every") != args.end())
+        {
+            every = std::max(std::stoull(args["-every"]), 1ull);
+        }
+    }
+
+    if (recordingPath == "")
+    {
+        std::cout << "Usage: -recording path [-step n] [-png path] [-frames prefix -from a -to b -every n]\n";
+        return 1;
+    }
+
+    RecordingReader recording(recordingPath);
+    std::cout << "Recording " << recording.getWidth() << "x" << recording.getHeight()
+              << ", seed: " << recording.getSeed()
+              << ", steps: " << recording.firstStep() << " to " << recording.lastStep()
+              << ", keyframes: " << recording.getKeys()
+              << "\n";
+
+    if (!seekStep) { target = recording.lastStep(); }
+
+    auto tic = std::chrono::steady_clock::now();
+    if (!recording.seek(target))
+    {
+        std::cout << "Step " << target << " is before the first frame\n";
+        return 1;
+    }
+    std::cout << "Step " << target << ", frame of step " << recording.getStep()
+              << ", particles: " << recording.getCells().count()
+              << ", seek: " << std::chrono::duration<double>(std::chrono::steady_clock::now()-tic).count()*1e3 << " ms"
+              << "\n";
+
+    if (pngPath != "")
+    {
+        std::vector<uint8_t> png = FrameRecorder::encode(recording.getCells(), {{0, 0, 0}, {255, 255, 255}});
+        std::ofstream file(pngPath, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(png.data()), png.size());
+    }
+
+    if (framesPrefix != "")
+    {
+        // every frame wanted, so wait for room rather than skip
+        FrameRecorder frames(framesPrefix, std::max(std::thread::hardware_concurrency(), 1u), 8, FrameRecorder::Policy::DROP);
+        to = std::min(to, recording.lastStep());
+        for (uint64_t s = std::max(from, recording.firstStep()); s <= to; s += every)
+        {
+            recording.seek(s);
+            while (!frames.push(s, recording.getCells())) { frames.finish(); }
+        }
+        frames.finish();
+        std::cout << "Frames written: " << frames.getWritten() << "\n";
+    }
+
+    return 0;
+}
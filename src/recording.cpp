@@ -0,0 +1,515 @@
+#include <recording.h>
+#include <checkpoint.h>
+#include <trace.h>
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    const char MAGIC[8] = {'S', 'N', 'O', 'W', 'R', 'E', 'C', 'D'};
+    const char INDEX_MAGIC[8] = {'S', 'N', 'O', 'W', 'R', 'I', 'D', 'X'};
+    const uint32_t VERSION = 1;
+    const uint64_t TILE = MargolusEngine::TILE;
+    const uint64_t HEADER_BYTES = 8+4+8+8+4+8;
+    const uint64_t RECORD_BYTES = 1+8+4;
+
+    void putFixed(std::vector<uint8_t> & out, uint64_t v, unsigned bytes)
+    {
+        for (unsigned b = 0; b < bytes; b++) { out.push_back(uint8_t(v >> (8*b))); }
+    }
+
+    uint64_t getFixed(const uint8_t * in, unsigned bytes)
+    {
+        uint64_t v = 0;
+        for (unsigned b = 0; b < bytes; b++) { v |= uint64_t(in[b]) << (8*b); }
+        return v;
+    }
+
+    void putVarint(std::vector<uint8_t> & out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(uint8_t(v));
+    }
+
+    uint64_t getVarint(const std::vector<uint8_t> & in, size_t & i)
+    {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (i >= in.size()) { throw std::runtime_error("Corrupt recording"); }
+            const uint8_t b = in[i++];
+            v |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) { return v; }
+        }
+        throw std::runtime_error("Corrupt recording");
+    }
+
+    uint64_t tileRows(uint64_t height, uint64_t ty)
+    {
+        return std::min(TILE, height-ty*TILE);
+    }
+
+    // one coded tile at i, as written by encodeTile, into words
+    void readTile(const std::vector<uint8_t> & in, size_t & i, uint64_t * words, uint64_t rows)
+    {
+        if (i+8 > in.size()) { throw std::runtime_error("Corrupt recording"); }
+        const uint32_t rleBytes = getFixed(&in[i], 4);
+        const uint32_t zBytes = getFixed(&in[i+4], 4);
+        i += 8;
+        const uint32_t bytes = codedTileBytes(rleBytes, zBytes);
+        if (i+bytes > in.size()) { throw std::runtime_error("Corrupt recording"); }
+        decodeTile(in.data()+i, rleBytes, zBytes, words, rows);
+        i += bytes;
+    }
+}
+
+RecordingWriter::RecordingWriter
+(
+    std::string path,
+    const MargolusEngine & engine,
+    uint64_t keyFrames,
+    size_t capacity
+)
+: file(path, std::ios::binary),
+  width(engine.getWidth()), height(engine.getHeight()),
+  tilesX(width/TILE), tilesY((height+TILE-1)/TILE),
+  capacity(std::max(capacity, size_t(1))),
+  frames(0), skipped(0), lastStep(0), closed(false),
+  previous(width, height),
+  keyFrames(std::max(keyFrames, uint64_t(1))), sinceKey(0), deltaBytes(0), offset(0),
+  written(0), terminate(false)
+{
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open recording "+path+" for writing");
+    }
+    std::vector<uint8_t> out(MAGIC, MAGIC+8);
+    putFixed(out, VERSION, 4);
+    putFixed(out, width, 8);
+    putFixed(out, height, 8);
+    putFixed(out, TILE, 4);
+    putFixed(out, engine.getSeed(), 8);
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+    offset = out.size();
+    writer = std::thread(&RecordingWriter::writeLoop, this);
+}
+
+RecordingWriter::~RecordingWriter()
+{
+    close();
+}
+
+uint64_t RecordingWriter::getWritten()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return written;
+}
+
+uint64_t RecordingWriter::getKeys()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return keys.size();
+}
+
+bool RecordingWriter::frame(const MargolusEngine & engine, bool wait)
+{
+    Trace::Scope scope("RecordingWriter::frame");
+    if (closed) { return false; }
+    frames++;
+
+    // every tile for the first frame, after that those changed since the
+    // last, none meaning this frame is the last and there is nothing to write
+    const uint64_t step = engine.getSteps();
+    const std::vector<uint64_t> & modified = engine.getModified();
+    const bool first = frames == skipped+1;
+    uint64_t tiles = 0;
+    if (first || engine.getLastModified() >= lastStep)
+    {
+        for (uint64_t t = 0; t < tilesX*tilesY; t++)
+        {
+            if (first || modified[t] >= lastStep) { tiles++; }
+        }
+    }
+    if (tiles == 0)
+    {
+        lastStep = step;
+        return true;
+    }
+
+    Record record;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (wait) { condition.wait(guard, [this] { return records.size() < capacity; }); }
+        else if (records.size() >= capacity)
+        {
+            // lastStep stays, so the next frame taken carries these changes
+            skipped++;
+            return false;
+        }
+        if (!spare.empty())
+        {
+            record = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+
+    const BitGrid & cells = engine.getCells();
+    record.kind = Kind::DELTA;
+    record.step = step;
+    record.tiles.resize(tiles);
+    record.words.resize(tiles*TILE);
+    uint64_t k = 0;
+    for (uint64_t t = 0; t < tilesX*tilesY; t++)
+    {
+        if (!first && modified[t] < lastStep) { continue; }
+        const uint64_t tx = t % tilesX;
+        const uint64_t ty = t / tilesX;
+        const uint64_t rows = tileRows(height, ty);
+        uint64_t * words = record.words.data()+k*TILE;
+        for (uint64_t r = 0; r < rows; r++) { words[r] = cells.row(ty*TILE+r)[tx]; }
+        record.tiles[k++] = t;
+    }
+    lastStep = step;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        records.push_back(std::move(record));
+    }
+    condition.notify_all();
+    return true;
+}
+
+void RecordingWriter::close()
+{
+    if (closed) { return; }
+    closed = true;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        records.push_back({Kind::END, lastStep, {}, {}});
+        terminate = true;
+    }
+    condition.notify_all();
+    writer.join();
+
+    // the writer is done, so keys and offset are this thread's
+    const uint64_t indexOffset = offset;
+    std::vector<uint8_t> payload;
+    putFixed(payload, lastStep, 8);
+    putVarint(payload, keys.size());
+    for (const auto & key : keys)
+    {
+        putFixed(payload, key.first, 8);
+        putFixed(payload, key.second, 8);
+    }
+    write(Kind::INDEX, lastStep, payload);
+    std::vector<uint8_t> trailer;
+    putFixed(trailer, indexOffset, 8);
+    trailer.insert(trailer.end(), INDEX_MAGIC, INDEX_MAGIC+8);
+    file.write(reinterpret_cast<const char*>(trailer.data()), trailer.size());
+    file.close();
+}
+
+void RecordingWriter::write(Kind kind, uint64_t step, const std::vector<uint8_t> & payload)
+{
+    if (kind == Kind::KEY)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        keys.push_back({step, offset});
+    }
+
+    std::vector<uint8_t> header;
+    header.push_back(uint8_t(kind));
+    putFixed(header, step, 8);
+    putFixed(header, payload.size(), 4);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+    offset += header.size()+payload.size();
+}
+
+void RecordingWriter::writeFrame(const Record & record)
+{
+    Trace::Scope scope("RecordingWriter::delta");
+    // the taken tiles XORed against the last frame written
+    coded.clear();
+    uint64_t changed = 0;
+    uint64_t lastTile = 0;
+    uint64_t words[TILE];
+    for (size_t k = 0; k < record.tiles.size(); k++)
+    {
+        const uint64_t t = record.tiles[k];
+        const uint64_t tx = t % tilesX;
+        const uint64_t ty = t / tilesX;
+        const uint64_t rows = tileRows(height, ty);
+        const uint64_t * now = record.words.data()+k*TILE;
+        uint64_t any = 0;
+        for (uint64_t r = 0; r < rows; r++)
+        {
+            uint64_t & then = previous.row(ty*TILE+r)[tx];
+            words[r] = now[r] ^ then;
+            any |= words[r];
+            then = now[r];
+        }
+        if (any == 0) { continue; }
+        putVarint(coded, t-lastTile);
+        encodeTile(words, rows, coded, false);
+        lastTile = t;
+        changed++;
+    }
+
+    // the first frame is always a keyframe, then only frames that changed something
+    const bool first = keys.empty();
+    if (!first && changed == 0) { return; }
+
+    std::vector<uint8_t> payload;
+    if (first || sinceKey >= keyFrames || deltaBytes >= KEY_DELTA_GRIDS*width*height/8)
+    {
+        Trace::Scope scope("RecordingWriter::key");
+        for (uint64_t ty = 0; ty < tilesY; ty++)
+        {
+            const uint64_t rows = tileRows(height, ty);
+            for (uint64_t tx = 0; tx < tilesX; tx++)
+            {
+                for (uint64_t r = 0; r < rows; r++) { words[r] = previous.row(ty*TILE+r)[tx]; }
+                encodeTile(words, rows, payload);
+            }
+        }
+        write(Kind::KEY, record.step, payload);
+        sinceKey = 1;
+        deltaBytes = 0;
+    }
+    else
+    {
+        payload.reserve(coded.size()+10);
+        putVarint(payload, changed);
+        payload.insert(payload.end(), coded.begin(), coded.end());
+        write(Kind::DELTA, record.step, payload);
+        sinceKey++;
+        deltaBytes += payload.size();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    written++;
+}
+
+void RecordingWriter::writeLoop()
+{
+    if (Trace::isEnabled()) { Trace::setThreadName("RecordingWriter"); }
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        condition.wait(guard, [this] { return terminate || !records.empty(); });
+        if (records.empty()) { return; }
+        Record record = std::move(records.front());
+        records.pop_front();
+        guard.unlock();
+
+        if (record.kind == Kind::END)
+        {
+            write(Kind::END, record.step, {});
+        }
+        else
+        {
+            writeFrame(record);
+        }
+
+        guard.lock();
+        spare.push_back(std::move(record));
+        // room for a frame waited for
+        condition.notify_all();
+    }
+}
+
+RecordingReader::RecordingReader(std::string path)
+: file(path, std::ios::binary), dataStart(HEADER_BYTES), end(0), step(0), positioned(false),
+  nextRecord(HEADER_BYTES)
+{
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open recording "+path);
+    }
+    file.seekg(0, std::ios::end);
+    fileBytes = file.tellg();
+    file.seekg(0);
+
+    uint8_t in[HEADER_BYTES];
+    if (!file.read(reinterpret_cast<char*>(in), HEADER_BYTES) || std::memcmp(in, MAGIC, 8) != 0)
+    {
+        throw std::runtime_error(path+" is not a recording");
+    }
+    if (getFixed(in+8, 4) != VERSION)
+    {
+        throw std::runtime_error("Unsupported recording version in "+path);
+    }
+    width = getFixed(in+12, 8);
+    height = getFixed(in+20, 8);
+    if (getFixed(in+28, 4) != TILE)
+    {
+        throw std::runtime_error("Recording "+path+" has an unsupported tile size");
+    }
+    seed = getFixed(in+32, 8);
+    tilesX = width/TILE;
+    tilesY = (height+TILE-1)/TILE;
+    cells = BitGrid(width, height);
+
+    // the index if the recording was closed, otherwise walk the records
+    bool indexed = false;
+    if (fileBytes >= dataStart+16)
+    {
+        uint8_t trailer[16];
+        file.clear();
+        file.seekg(fileBytes-16);
+        Header h;
+        if
+        (
+            file.read(reinterpret_cast<char*>(trailer), 16) &&
+            std::memcmp(trailer+8, INDEX_MAGIC, 8) == 0 &&
+            readHeader(getFixed(trailer, 8), h) &&
+            h.kind == RecordingWriter::Kind::INDEX
+        )
+        {
+            std::vector<uint8_t> payload(h.bytes);
+            file.read(reinterpret_cast<char*>(payload.data()), h.bytes);
+            if (payload.size() < 8) { throw std::runtime_error("Corrupt recording index"); }
+            end = getFixed(payload.data(), 8);
+            size_t i = 8;
+            const uint64_t n = getVarint(payload, i);
+            if (i+16*n > payload.size()) { throw std::runtime_error("Corrupt recording index"); }
+            for (uint64_t k = 0; k < n; k++, i += 16)
+            {
+                keys.push_back({getFixed(&payload[i], 8), getFixed(&payload[i+8], 8)});
+            }
+            indexed = true;
+        }
+    }
+    if (!indexed) { scan(); }
+}
+
+bool RecordingReader::readHeader(uint64_t at, Header & header)
+{
+    if (at+RECORD_BYTES > fileBytes) { return false; }
+    uint8_t in[RECORD_BYTES];
+    file.clear();
+    file.seekg(at);
+    if (!file.read(reinterpret_cast<char*>(in), RECORD_BYTES)) { return false; }
+    if (in[0] > uint8_t(RecordingWriter::Kind::INDEX)) { return false; }
+    header.kind = RecordingWriter::Kind(in[0]);
+    header.step = getFixed(in+1, 8);
+    header.bytes = getFixed(in+9, 4);
+    return at+RECORD_BYTES+header.bytes <= fileBytes;
+}
+
+void RecordingReader::scan()
+{
+    uint64_t at = dataStart;
+    Header h;
+    while (readHeader(at, h))
+    {
+        if (h.kind == RecordingWriter::Kind::KEY) { keys.push_back({h.step, at}); }
+        if (h.kind == RecordingWriter::Kind::INDEX) { break; }
+        end = h.step;
+        at += RECORD_BYTES+h.bytes;
+    }
+}
+
+void RecordingReader::apply(const Header & header, uint64_t at)
+{
+    std::vector<uint8_t> payload(header.bytes);
+    file.clear();
+    file.seekg(at+RECORD_BYTES);
+    if (!file.read(reinterpret_cast<char*>(payload.data()), header.bytes))
+    {
+        throw std::runtime_error("Recording is truncated");
+    }
+
+    uint64_t words[TILE];
+    size_t i = 0;
+    if (header.kind == RecordingWriter::Kind::KEY)
+    {
+        for (uint64_t ty = 0; ty < tilesY; ty++)
+        {
+            const uint64_t rows = tileRows(height, ty);
+            for (uint64_t tx = 0; tx < tilesX; tx++)
+            {
+                readTile(payload, i, words, rows);
+                for (uint64_t r = 0; r < rows; r++) { cells.row(ty*TILE+r)[tx] = words[r]; }
+            }
+        }
+    }
+    else
+    {
+        const uint64_t n = getVarint(payload, i);
+        uint64_t t = 0;
+        for (uint64_t k = 0; k < n; k++)
+        {
+            t += getVarint(payload, i);
+            if (t >= tilesX*tilesY) { throw std::runtime_error("Corrupt recording"); }
+            const uint64_t tx = t % tilesX;
+            const uint64_t ty = t / tilesX;
+            const uint64_t rows = tileRows(height, ty);
+            readTile(payload, i, words, rows);
+            for (uint64_t r = 0; r < rows; r++) { cells.row(ty*TILE+r)[tx] ^= words[r]; }
+        }
+    }
+
+    step = header.step;
+    positioned = true;
+    nextRecord = at+RECORD_BYTES+header.bytes;
+}
+
+bool RecordingReader::seek(uint64_t target)
+{
+    Trace::Scope scope("RecordingReader::seek");
+    if (keys.empty() || target < keys.front().first) { return false; }
+
+    auto key = std::upper_bound
+    (
+        keys.begin(), keys.end(), target,
+        [](uint64_t s, const std::pair<uint64_t, uint64_t> & k) { return s < k.first; }
+    );
+    key--;
+
+    // carry on from here unless the keyframe is nearer
+    if (!positioned || step > target || step < key->first)
+    {
+        Header h;
+        if (!readHeader(key->second, h) || h.kind != RecordingWriter::Kind::KEY)
+        {
+            throw std::runtime_error("Corrupt recording index");
+        }
+        apply(h, key->second);
+    }
+
+    Header h;
+    while
+    (
+        readHeader(nextRecord, h) &&
+        (h.kind == RecordingWriter::Kind::KEY || h.kind == RecordingWriter::Kind::DELTA) &&
+        h.step <= target
+    )
+    {
+        apply(h, nextRecord);
+    }
+    return true;
+}
+
+bool RecordingReader::next()
+{
+    if (!positioned) { return seek(firstStep()); }
+    Header h;
+    if
+    (
+        readHeader(nextRecord, h) &&
+        (h.kind == RecordingWriter::Kind::KEY || h.kind == RecordingWriter::Kind::DELTA)
+    )
+    {
+        apply(h, nextRecord);
+        return true;
+    }
+    return false;
+}